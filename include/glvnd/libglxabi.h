@@ -100,7 +100,7 @@ extern "C" {
  * will still work.
  */
 #define GLX_VENDOR_ABI_MAJOR_VERSION ((uint32_t) 1)
-#define GLX_VENDOR_ABI_MINOR_VERSION ((uint32_t) 0)
+#define GLX_VENDOR_ABI_MINOR_VERSION ((uint32_t) 2)
 #define GLX_VENDOR_ABI_VERSION ((GLX_VENDOR_ABI_MAJOR_VERSION << 16) | GLX_VENDOR_ABI_MINOR_VERSION)
 static inline uint32_t GLX_VENDOR_ABI_GET_MAJOR_VERSION(uint32_t version)
 {
@@ -390,6 +390,38 @@ typedef struct __GLXapiImportsRec {
      */
     void (*patchThreadAttach)(void);
 
+    /*!
+     * (OPTIONAL) Looks up the addresses of a list of OpenGL functions.
+     *
+     * libGLX uses this, if it's available, to fill in a vendor's OpenGL
+     * dispatch table with a single call, instead of calling
+     * \c getProcAddress for every function. The result for each function
+     * must be the same as what \c getProcAddress would return.
+     *
+     * This function was added in version 1.1 of the ABI.
+     *
+     * \param procNames The names of the functions to look up.
+     * \param count The number of elements in \p procNames and \p procs.
+     * \param[out] procs Receives the address of each function, or \c NULL
+     * if the vendor library does not support that function.
+     */
+    void (*getProcAddressList)(const GLubyte * const *procNames,
+                               int count, void **procs);
+
+    /*!
+     * (OPTIONAL) Checks whether libglvnd may patch the entrypoints while
+     * other threads have one of this vendor's contexts current.
+     *
+     * Without this, libglvnd only patches the entrypoints when no other
+     * thread has a current context. With it, a thread that's already current
+     * may start running the patched entrypoints without calling
+     * \c patchThreadAttach first, so the vendor library must only return
+     * GL_TRUE if its patched code can handle that.
+     *
+     * This function was added in version 1.2 of the ABI.
+     */
+    GLboolean (*isLivePatchSupported)(void);
+
 } __GLXapiImports;
 
 /*****************************************************************************/
@@ -20,7 +20,7 @@ static int FindProcIndex(const char *name)
     while (first <= last) {
         unsigned middle = (first + last) / 2;
         int comp = strcmp(name,
-                          __EGL_DISPATCH_FUNC_NAMES[middle]);
+                          __eglDispatchFuncName(middle));
 
         if (comp > 0)
             first = middle + 1;
@@ -65,7 +65,7 @@ static __eglMustCastToProperFunctionPointerType FetchVendorFunc(__EGLvendorInfo
     }
     if (func == NULL) {
         if (errorCode != EGL_SUCCESS) {
-            __eglReportError(errorCode, __EGL_DISPATCH_FUNC_NAMES[index], NULL, NULL);
+            __eglReportError(errorCode, __eglDispatchFuncName(index), NULL, NULL);
         }
         return NULL;
     }
@@ -73,7 +73,7 @@ static __eglMustCastToProperFunctionPointerType FetchVendorFunc(__EGLvendorInfo
     if (!exports->setLastVendor(vendor)) {
         // Don't bother trying to set an error code. If setLastVendor
         // failed, then setEGLError would also fail.
-        __eglReportError(EGL_BAD_ALLOC, __EGL_DISPATCH_FUNC_NAMES[index], NULL,
+        __eglReportError(EGL_BAD_ALLOC, __eglDispatchFuncName(index), NULL,
                 "Could not initialize thread state");
         return NULL;
     }
@@ -1,15 +1,26 @@
 #ifndef EGLDISPATCHSTUBS_H
 #define EGLDISPATCHSTUBS_H
 
+#include <stdint.h>
+
 #include "glvnd/libeglabi.h"
 #include "compiler.h"
 
 // These variables are all generated along with the dispatch stubs.
 extern const int __EGL_DISPATCH_FUNC_COUNT;
-extern const char * const __EGL_DISPATCH_FUNC_NAMES[];
+extern const char __EGL_DISPATCH_FUNC_NAME_POOL[];
+extern const uint32_t __EGL_DISPATCH_FUNC_NAME_OFFSETS[];
 extern int __EGL_DISPATCH_FUNC_INDICES[];
 extern const __eglMustCastToProperFunctionPointerType __EGL_DISPATCH_FUNCS[];
 
+/**
+ * Returns the name of the function at \p index.
+ */
+static inline const char *__eglDispatchFuncName(int index)
+{
+    return __EGL_DISPATCH_FUNC_NAME_POOL + __EGL_DISPATCH_FUNC_NAME_OFFSETS[index];
+}
+
 void __eglInitDispatchStubs(const __EGLapiExports *exportsTable);
 void __eglSetDispatchIndex(const char *name, int index);
 
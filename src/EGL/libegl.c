@@ -1025,83 +1025,47 @@ PUBLIC __eglMustCastToProperFunctionPointerType EGLAPIENTRY eglGetProcAddress(co
 }
 
 
-// TODO: Move the Atomic* functions to a common file.
-int AtomicIncrement(int volatile *val)
-{
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_add_and_fetch(val, 1);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
-    int delta = 1;
-
-    __asm __volatile__ ("lock; xaddl %0, %1"
-                        : "=r" (result), "=m" (*val)
-                        : "0" (delta), "m" (*val));
+static void __eglResetOnFork(void);
 
-    return result + delta;
-#else
-#error "Not implemented"
-#endif
-}
+/*
+ * Fork detection. The child handler from pthread_atfork bumps
+ * g_forkGeneration, and then the first EGL entrypoint that sees that it
+ * doesn't match g_resetGeneration does the actual recovery.
+ */
+static volatile unsigned int g_forkGeneration = 0;
+static volatile unsigned int g_resetGeneration = 0;
 
-int AtomicSwap(int volatile *val, int newVal)
-{
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_lock_test_and_set(val, newVal);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
+/*
+ * Held while recovering from a fork, so that other threads wait for it to
+ * finish.
+ */
+static glvnd_mutex_t g_forkMutex = GLVND_MUTEX_INITIALIZER;
 
-    __asm __volatile__ ("xchgl %0, %1"
-                        : "=r" (result), "=m" (*val)
-                        : "0" (newVal), "m" (*val));
+/*
+ * If pthread_atfork fails, then this is the process ID from when the library
+ * was loaded, and CheckFork compares it against getpid() instead.
+ */
+static volatile pid_t g_forkCheckPid = 0;
 
-    return result;
-#else
-#error "Not implemented"
-#endif
+static void __eglForkPrepare(void)
+{
+    // Don't let another thread fork in the middle of a reset.
+    __glvndPthreadFuncs.mutex_lock(&g_forkMutex);
 }
 
-int AtomicCompareAndSwap(int volatile *val, int oldVal, int newVal)
+static void __eglForkParent(void)
 {
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_val_compare_and_swap(val, oldVal, newVal);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
-
-    __asm __volatile__ ("lock; cmpxchgl %2, %1"
-                        : "=a" (result), "=m" (*val)
-                        : "r" (newVal), "m" (*val), "0" (oldVal));
-
-    return result;
-#else
-#error "Not implemented"
-#endif
+    __glvndPthreadFuncs.mutex_unlock(&g_forkMutex);
 }
 
-int AtomicDecrementClampAtZero(int volatile *val)
+static void __eglForkChild(void)
 {
-    int oldVal, newVal;
-
-    oldVal = *val;
-    newVal = oldVal;
-
-    do {
-        if (oldVal <= 0) {
-            assert(oldVal == 0);
-        } else {
-            newVal = oldVal - 1;
-            if (newVal < 0) {
-                newVal = 0;
-            }
-            oldVal = AtomicCompareAndSwap(val, oldVal, newVal);
-        }
-    } while ((oldVal > 0) && (newVal != oldVal - 1));
-
-    return newVal;
+    // The calling thread is the only one in the child process, so nothing
+    // else can be looking at these.
+    __glvndPthreadFuncs.mutex_init(&g_forkMutex, NULL);
+    g_forkGeneration++;
 }
 
-static void __eglResetOnFork(void);
-
 /*
  * Perform checks that need to occur when entering any EGL entrypoint.
  * Currently, this only detects whether a fork occurred since the last
@@ -1109,36 +1073,31 @@ static void __eglResetOnFork(void);
  */
 void CheckFork(void)
 {
-    volatile static int g_threadsInCheck = 0;
-    volatile static int g_lastPid = -1;
-
-    int lastPid;
-    int pid = getpid();
-
-    AtomicIncrement(&g_threadsInCheck);
-
-    lastPid = AtomicSwap(&g_lastPid, pid);
+    if (g_forkCheckPid != 0) {
+        pid_t lastPid = g_forkCheckPid;
+        pid_t pid = getpid();
+        if (pid != lastPid
+                && __sync_bool_compare_and_swap(&g_forkCheckPid, lastPid, pid)) {
+            __eglForkChild();
+        }
+    }
 
-    if ((lastPid != -1) &&
-        (lastPid != pid)) {
+    if (g_resetGeneration == g_forkGeneration) {
+        return;
+    }
 
+    __glvndPthreadFuncs.mutex_lock(&g_forkMutex);
+    if (g_resetGeneration != g_forkGeneration) {
         DBG_PRINTF(0, "Fork detected\n");
 
         __eglResetOnFork();
 
-        // Force g_threadsInCheck to 0 to unblock other threads waiting here.
-        g_threadsInCheck = 0;
-    } else {
-        AtomicDecrementClampAtZero(&g_threadsInCheck);
-        while (g_threadsInCheck > 0) {
-            // Wait for other threads to finish checking for a fork.
-            //
-            // If a fork happens while g_threadsInCheck > 0 the _first_ thread
-            // to enter __eglThreadInitialize() will see the fork, handle it, and force
-            // g_threadsInCheck to 0, unblocking any other threads stuck here.
-            sched_yield();
-        }
+        // Make sure that the reset is visible before any thread can skip the
+        // lock above.
+        __sync_synchronize();
+        g_resetGeneration = g_forkGeneration;
     }
+    __glvndPthreadFuncs.mutex_unlock(&g_forkMutex);
 }
 
 void __eglThreadInitialize(void)
@@ -1200,7 +1159,10 @@ void _init(void)
     __eglCurrentInit();
     __eglInitVendors();
 
-    /* TODO install fork handlers using __register_atfork */
+    if (pthread_atfork(__eglForkPrepare, __eglForkParent, __eglForkChild) != 0) {
+        DBG_PRINTF(0, "pthread_atfork failed, checking the process ID instead\n");
+        g_forkCheckPid = getpid();
+    }
 
     DBG_PRINTF(0, "Loading EGL...\n");
 
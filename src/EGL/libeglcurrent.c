@@ -8,10 +8,14 @@ static void OnThreadDestroyed(void *data);
 
 static __EGLThreadAPIState *CreateThreadState(void);
 static void DestroyThreadState(__EGLThreadAPIState *threadState);
+static void FreeAPIState(__EGLdispatchThreadState *apiState);
 
 /**
  * A list of current __EGLdispatchThreadState structures. This is used so that we can
  * clean up at process termination or after a fork.
+ *
+ * This also includes the spare structures in __EGLThreadAPIState::spareAPIState,
+ * so a structure is only added or removed when it's allocated or freed.
  */
 static struct glvnd_list currentAPIStateList;
 static struct glvnd_list currentThreadStateList;
@@ -85,18 +89,24 @@ void __eglCurrentInit(void)
 
 void __eglCurrentTeardown(EGLBoolean doReset)
 {
-    while (!glvnd_list_is_empty(&currentAPIStateList)) {
-        __EGLdispatchThreadState *apiState = glvnd_list_first_entry(
-                &currentAPIStateList, __EGLdispatchThreadState, entry);
-        __eglDestroyAPIState(apiState);
-    }
-
+    // Free the thread states first, since that also frees any spare API
+    // states.
     while (!glvnd_list_is_empty(&currentThreadStateList)) {
         __EGLThreadAPIState *threadState = glvnd_list_first_entry(
                 &currentThreadStateList, __EGLThreadAPIState, entry);
         DestroyThreadState(threadState);
     }
 
+    while (!glvnd_list_is_empty(&currentAPIStateList)) {
+        __EGLdispatchThreadState *apiState = glvnd_list_first_entry(
+                &currentAPIStateList, __EGLdispatchThreadState, entry);
+        FreeAPIState(apiState);
+    }
+
+    // The current thread's state is gone now, so don't leave a dangling
+    // pointer for the next call to __eglGetCurrentThreadAPIState.
+    __glvndPthreadFuncs.setspecific(threadStateKey, NULL);
+
     if (doReset) {
         __glvndPthreadFuncs.mutex_init(&currentStateListMutex, NULL);
     }
@@ -136,6 +146,11 @@ __EGLThreadAPIState *__eglGetCurrentThreadAPIState(EGLBoolean create)
 void DestroyThreadState(__EGLThreadAPIState *threadState)
 {
     if (threadState != NULL) {
+        if (threadState->spareAPIState != NULL) {
+            FreeAPIState(threadState->spareAPIState);
+            threadState->spareAPIState = NULL;
+        }
+
         __glvndPthreadFuncs.mutex_lock(&currentStateListMutex);
         glvnd_list_del(&threadState->entry);
         __glvndPthreadFuncs.mutex_unlock(&currentStateListMutex);
@@ -161,13 +176,26 @@ void OnThreadDestroyed(void *data)
 
 __EGLdispatchThreadState *__eglCreateAPIState(void)
 {
-    __EGLdispatchThreadState *apiState = calloc(1, sizeof(__EGLdispatchThreadState));
-    if (apiState == NULL) {
-        return NULL;
+    __EGLThreadAPIState *threadState = __eglGetCurrentThreadAPIState(EGL_FALSE);
+    __EGLdispatchThreadState *apiState;
+
+    if (threadState != NULL && threadState->spareAPIState != NULL) {
+        apiState = threadState->spareAPIState;
+        threadState->spareAPIState = NULL;
+    } else {
+        apiState = calloc(1, sizeof(__EGLdispatchThreadState));
+        if (apiState == NULL) {
+            return NULL;
+        }
+
+        __glvndPthreadFuncs.mutex_lock(&currentStateListMutex);
+        glvnd_list_add(&apiState->entry, &currentAPIStateList);
+        __glvndPthreadFuncs.mutex_unlock(&currentStateListMutex);
     }
 
     apiState->glas.tag = GLDISPATCH_API_EGL;
     apiState->glas.threadDestroyedCallback = OnDispatchThreadDestroyed;
+    apiState->glas.priv = NULL;
 
     apiState->currentDisplay = NULL;
     apiState->currentDraw = EGL_NO_SURFACE;
@@ -175,27 +203,38 @@ __EGLdispatchThreadState *__eglCreateAPIState(void)
     apiState->currentContext = EGL_NO_CONTEXT;
     apiState->currentVendor = NULL;
 
-    __glvndPthreadFuncs.mutex_lock(&currentStateListMutex);
-    glvnd_list_add(&apiState->entry, &currentAPIStateList);
-    __glvndPthreadFuncs.mutex_unlock(&currentStateListMutex);
-
     return apiState;
 }
 
 void __eglDestroyAPIState(__EGLdispatchThreadState *apiState)
 {
     if (apiState != NULL) {
-        __glvndPthreadFuncs.mutex_lock(&currentStateListMutex);
-        glvnd_list_del(&apiState->entry);
-        __glvndPthreadFuncs.mutex_unlock(&currentStateListMutex);
+        __EGLThreadAPIState *threadState = __eglGetCurrentThreadAPIState(EGL_FALSE);
 
-        free(apiState);
+        // Keep the API state around for the next eglMakeCurrent call, unless
+        // we've already got a spare one.
+        if (threadState != NULL && threadState->spareAPIState == NULL) {
+            threadState->spareAPIState = apiState;
+        } else {
+            FreeAPIState(apiState);
+        }
     }
 }
 
+void FreeAPIState(__EGLdispatchThreadState *apiState)
+{
+    __glvndPthreadFuncs.mutex_lock(&currentStateListMutex);
+    glvnd_list_del(&apiState->entry);
+    __glvndPthreadFuncs.mutex_unlock(&currentStateListMutex);
+
+    free(apiState);
+}
+
 void OnDispatchThreadDestroyed(__GLdispatchThreadState *state)
 {
+    // The thread is terminating, so free the API state instead of keeping it
+    // as a spare.
     __EGLdispatchThreadState *eglState = (__EGLdispatchThreadState *) state;
-    __eglDestroyAPIState(eglState);
+    FreeAPIState(eglState);
 }
 
@@ -78,6 +78,13 @@ typedef struct __EGLThreadAPIStateRec {
 
     EGLLabelKHR label;
 
+    /*!
+     * An unused \c __EGLdispatchThreadState struct. When this thread releases
+     * its current context, \c __eglDestroyAPIState keeps the struct here so
+     * that the next eglMakeCurrent call doesn't need to allocate a new one.
+     */
+    __EGLdispatchThreadState *spareAPIState;
+
     struct glvnd_list entry;
 } __EGLThreadAPIState;
 
@@ -231,7 +231,7 @@ void __eglMappingInit(void)
     __eglInitDispatchStubs(&__eglExportsTable);
     for (i=0; i<__EGL_DISPATCH_FUNC_COUNT; i++) {
         int index = __glvndWinsysDispatchAllocIndex(
-                __EGL_DISPATCH_FUNC_NAMES[i],
+                __eglDispatchFuncName(i),
                 __EGL_DISPATCH_FUNCS[i]);
         if (index < 0) {
             fprintf(stderr, "Could not allocate dispatch index array\n");
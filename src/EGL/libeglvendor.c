@@ -253,6 +253,14 @@ static void *VendorGetProcAddressCallback(const char *procName, void *param)
     return vendor->eglvc.getProcAddress(procName);
 }
 
+static GLboolean VendorGetProcAddressListCallback(const char * const *procNames,
+        int count, void **procs, void *param)
+{
+    __EGLvendorInfo *vendor = (__EGLvendorInfo *) param;
+    vendor->eglvc.getProcAddressList(procNames, count, procs);
+    return GL_TRUE;
+}
+
 static EGLBoolean CheckFormatVersion(const char *versionStr)
 {
     int major, minor, rev;
@@ -476,6 +484,7 @@ static __EGLvendorInfo *LoadVendor(const char *filename)
         vendor->patchCallbacks.initiatePatch = vendor->eglvc.initiatePatch;
         vendor->patchCallbacks.releasePatch = vendor->eglvc.releasePatch;
         vendor->patchCallbacks.threadAttach = vendor->eglvc.patchThreadAttach;
+        vendor->patchCallbacks.isLivePatchSupported = vendor->eglvc.isLivePatchSupported;
         vendor->patchSupported = EGL_TRUE;
     }
 
@@ -493,7 +502,9 @@ static __EGLvendorInfo *LoadVendor(const char *filename)
     assert(vendor->vendorID >= 0);
 
     // TODO: Allow per-context dispatch tables?
-    vendor->glDispatch = __glDispatchCreateTable(VendorGetProcAddressCallback, vendor);
+    vendor->glDispatch = __glDispatchCreateTableWithList(VendorGetProcAddressCallback,
+            (vendor->eglvc.getProcAddressList != NULL ? VendorGetProcAddressListCallback : NULL),
+            vendor);
     if (!vendor->glDispatch) {
         goto fail;
     }
@@ -510,7 +521,7 @@ static __EGLvendorInfo *LoadVendor(const char *filename)
     }
     for (i=0; i<__EGL_DISPATCH_FUNC_COUNT; i++) {
         vendor->eglvc.setDispatchIndex(
-                __EGL_DISPATCH_FUNC_NAMES[i],
+                __eglDispatchFuncName(i),
                 __EGL_DISPATCH_FUNC_INDICES[i]);
     }
 
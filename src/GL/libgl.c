@@ -28,6 +28,8 @@
  */
 
 #include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include "libgl.h"
@@ -45,6 +47,13 @@ void __attribute__((constructor)) __libGLInit(void)
 void _init(void)
 #endif
 {
+    // The stub callbacks that we register below have to match the layout
+    // that libGLdispatch expects.
+    if (__glDispatchGetABIVersion() != GLDISPATCH_ABI_VERSION) {
+        fprintf(stderr, "libGLdispatch ABI version is incompatible with libGL.\n");
+        abort();
+    }
+
     // Fix up the static GL entrypoints, if necessary
     entry_init_public();
 
@@ -88,14 +88,27 @@ static __GLXcontextInfo *glxContextHash = NULL;
 static glvnd_mutex_t glxContextHashLock;
 
 /**
- * A list of current __GLXThreadState structures. This is used so that we can
- * clean up at process termination or after a fork.
+ * A list of all allocated __GLXThreadState structures. This is used so that we
+ * can clean up at process termination or after a fork.
+ *
+ * This includes the spare thread states in \c spareThreadStateKey, so a
+ * thread state is only added or removed when it's allocated or freed, not
+ * every time a thread makes a context current.
  */
 static struct glvnd_list currentThreadStateList;
 static glvnd_mutex_t currentThreadStateListMutex = GLVND_MUTEX_INITIALIZER;
 
+/**
+ * The key used to store an unused __GLXThreadState struct for the current
+ * thread. When a thread releases its current context, DestroyThreadState
+ * leaves the thread state here, so that the next glXMakeCurrent call doesn't
+ * need to allocate a new one.
+ */
+static glvnd_key_t spareThreadStateKey;
+
 static __GLXThreadState *CreateThreadState(__GLXvendorInfo *vendor);
 static void DestroyThreadState(__GLXThreadState *threadState);
+static void FreeThreadState(__GLXThreadState *threadState);
 
 /*!
  * Updates the current context.
@@ -603,28 +616,56 @@ static void ThreadDestroyed(__GLdispatchThreadState *threadState)
     UpdateCurrentContext(NULL, glxState->currentContext);
     __glvndPthreadFuncs.mutex_unlock(&glxContextHashLock);
 
-    // Free the thread state struct.
-    DestroyThreadState(glxState);
+    // Free the thread state struct. The thread is terminating, so don't
+    // bother trying to keep it as a spare.
+    FreeThreadState(glxState);
+}
+
+static void SpareThreadStateDestroyed(void *data)
+{
+    FreeThreadState((__GLXThreadState *) data);
 }
 
 static __GLXThreadState *CreateThreadState(__GLXvendorInfo *vendor)
 {
-    __GLXThreadState *threadState = calloc(1, sizeof(*threadState));
+    __GLXThreadState *threadState = (__GLXThreadState *)
+        __glvndPthreadFuncs.getspecific(spareThreadStateKey);
 
-    assert(threadState);
+    if (threadState != NULL) {
+        __glvndPthreadFuncs.setspecific(spareThreadStateKey, NULL);
+    } else {
+        threadState = calloc(1, sizeof(*threadState));
+        assert(threadState);
+
+        __glvndPthreadFuncs.mutex_lock(&currentThreadStateListMutex);
+        glvnd_list_add(&threadState->entry, &currentThreadStateList);
+        __glvndPthreadFuncs.mutex_unlock(&currentThreadStateListMutex);
+    }
 
     threadState->glas.tag = GLDISPATCH_API_GLX;
     threadState->glas.threadDestroyedCallback = ThreadDestroyed;
+    threadState->glas.priv = NULL;
     threadState->currentVendor = vendor;
-
-    __glvndPthreadFuncs.mutex_lock(&currentThreadStateListMutex);
-    glvnd_list_add(&threadState->entry, &currentThreadStateList);
-    __glvndPthreadFuncs.mutex_unlock(&currentThreadStateListMutex);
+    threadState->currentDisplay = NULL;
+    threadState->currentDraw = None;
+    threadState->currentRead = None;
+    threadState->currentContext = NULL;
 
     return threadState;
 }
 
 static void DestroyThreadState(__GLXThreadState *threadState)
+{
+    // Keep the thread state around for the next glXMakeCurrent call, unless
+    // we've already got a spare one.
+    if (__glvndPthreadFuncs.getspecific(spareThreadStateKey) == NULL) {
+        __glvndPthreadFuncs.setspecific(spareThreadStateKey, threadState);
+    } else {
+        FreeThreadState(threadState);
+    }
+}
+
+static void FreeThreadState(__GLXThreadState *threadState)
 {
     // Free the thread state struct.
     __glvndPthreadFuncs.mutex_lock(&currentThreadStateListMutex);
@@ -1799,115 +1840,80 @@ PUBLIC __GLXextFuncPtr __glXGLLoadGLXFunction(const char *name,
     return func;
 }
 
-int AtomicIncrement(int volatile *val)
-{
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_add_and_fetch(val, 1);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
-    int delta = 1;
-
-    __asm __volatile__ ("lock; xaddl %0, %1"
-                        : "=r" (result), "=m" (*val)
-                        : "0" (delta), "m" (*val));
+static void __glXResetOnFork(void);
 
-    return result + delta;
-#else
-#error "Not implemented"
-#endif
-}
+/*
+ * Fork detection. The child handler from pthread_atfork bumps
+ * g_forkGeneration, and then the first GLX entrypoint that sees that it
+ * doesn't match g_resetGeneration does the actual recovery. That way, the
+ * check in every entrypoint is just a couple of loads, and we don't try to
+ * do anything complicated from inside fork itself.
+ */
+static volatile unsigned int g_forkGeneration = 0;
+static volatile unsigned int g_resetGeneration = 0;
 
-int AtomicSwap(int volatile *val, int newVal)
-{
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_lock_test_and_set(val, newVal);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
+/*
+ * Held while recovering from a fork, so that other threads wait for it to
+ * finish.
+ */
+static glvnd_mutex_t g_forkMutex = GLVND_MUTEX_INITIALIZER;
 
-    __asm __volatile__ ("xchgl %0, %1"
-                        : "=r" (result), "=m" (*val)
-                        : "0" (newVal), "m" (*val));
+/*
+ * If pthread_atfork fails, then this is the process ID from when the library
+ * was loaded, and CheckFork compares it against getpid() instead.
+ */
+static volatile pid_t g_forkCheckPid = 0;
 
-    return result;
-#else
-#error "Not implemented"
-#endif
+static void __glXForkPrepare(void)
+{
+    // Don't let another thread fork in the middle of a reset.
+    __glvndPthreadFuncs.mutex_lock(&g_forkMutex);
 }
 
-int AtomicCompareAndSwap(int volatile *val, int oldVal, int newVal)
+static void __glXForkParent(void)
 {
-#if defined(HAVE_SYNC_INTRINSICS)
-    return __sync_val_compare_and_swap(val, oldVal, newVal);
-#elif defined(USE_X86_ASM) || defined(USE_X86_64_ASM)
-    int result;
-
-    __asm __volatile__ ("lock; cmpxchgl %2, %1"
-                        : "=a" (result), "=m" (*val)
-                        : "r" (newVal), "m" (*val), "0" (oldVal));
-
-    return result;
-#else
-#error "Not implemented"
-#endif
+    __glvndPthreadFuncs.mutex_unlock(&g_forkMutex);
 }
 
-int AtomicDecrementClampAtZero(int volatile *val)
+static void __glXForkChild(void)
 {
-    int oldVal, newVal;
-
-    oldVal = *val;
-    newVal = oldVal;
-
-    do {
-        if (oldVal <= 0) {
-            assert(oldVal == 0);
-        } else {
-            newVal = oldVal - 1;
-            oldVal = AtomicCompareAndSwap(val, oldVal, newVal);
-        }
-    } while ((oldVal > 0) && (newVal != oldVal - 1));
-
-    return newVal;
+    // The calling thread is the only one in the child process, so nothing
+    // else can be looking at these.
+    __glvndPthreadFuncs.mutex_init(&g_forkMutex, NULL);
+    g_forkGeneration++;
 }
 
-static void __glXResetOnFork(void);
-
 /*!
  * Checks to see if a fork occurred since the last GLX entrypoint was called,
  * and performs recovery if needed.
  */
 static void CheckFork(void)
 {
-    volatile static int g_threadsInCheck = 0;
-    volatile static int g_lastPid = -1;
-
-    int lastPid;
-    int pid = getpid();
-
-    AtomicIncrement(&g_threadsInCheck);
-
-    lastPid = AtomicSwap(&g_lastPid, pid);
+    if (g_forkCheckPid != 0) {
+        pid_t lastPid = g_forkCheckPid;
+        pid_t pid = getpid();
+        if (pid != lastPid
+                && __sync_bool_compare_and_swap(&g_forkCheckPid, lastPid, pid)) {
+            __glXForkChild();
+        }
+    }
 
-    if ((lastPid != -1) &&
-        (lastPid != pid)) {
+    if (g_resetGeneration == g_forkGeneration) {
+        return;
+    }
 
+    __glvndPthreadFuncs.mutex_lock(&g_forkMutex);
+    if (g_resetGeneration != g_forkGeneration) {
         DBG_PRINTF(0, "Fork detected\n");
 
         __glXResetOnFork();
 
-        // Force g_threadsInCheck to 0 to unblock other threads waiting here.
-        g_threadsInCheck = 0;
-    } else {
-        AtomicDecrementClampAtZero(&g_threadsInCheck);
-        while (g_threadsInCheck > 0) {
-            // Wait for other threads to finish checking for a fork.
-            //
-            // If a fork happens while g_threadsInCheck > 0 the _first_ thread
-            // to enter __glXThreadInitialize() will see the fork, handle it, and force
-            // g_threadsInCheck to 0, unblocking any other threads stuck here.
-            sched_yield();
-        }
+        // Make sure that the reset is visible before any thread can skip the
+        // lock above.
+        __sync_synchronize();
+        g_resetGeneration = g_forkGeneration;
     }
+    __glvndPthreadFuncs.mutex_unlock(&g_forkMutex);
 }
 
 /*!
@@ -1930,6 +1936,10 @@ static void __glXAPITeardown(Bool doReset)
         free(threadState);
     }
 
+    // The spare thread state for this thread (if any) is in the list, too, so
+    // it's already been freed.
+    __glvndPthreadFuncs.setspecific(spareThreadStateKey, NULL);
+
     if (doReset) {
         /*
          * XXX: We should be able to get away with just resetting the proc address
@@ -1994,6 +2004,7 @@ void _init(void)
     glvndAppErrorCheckInit();
 
     glvnd_list_init(&currentThreadStateList);
+    __glvndPthreadFuncs.key_create(&spareThreadStateKey, SpareThreadStateDestroyed);
 
     /*
      * glxContextHashLock must be a recursive mutex, because we'll have it
@@ -2022,7 +2033,10 @@ void _init(void)
         }
     }
 
-    /* TODO install fork handlers using __register_atfork */
+    if (pthread_atfork(__glXForkPrepare, __glXForkParent, __glXForkChild) != 0) {
+        DBG_PRINTF(0, "pthread_atfork failed, checking the process ID instead\n");
+        g_forkCheckPid = getpid();
+    }
 
     DBG_PRINTF(0, "Loading GLX...\n");
 
@@ -2056,6 +2070,7 @@ void _fini(void)
 
     /* Tear down all GLX API state */
     __glXAPITeardown(False);
+    __glvndPthreadFuncs.key_delete(spareThreadStateKey);
 
     /* Tear down all mapping state */
     __glXMappingTeardown(False);
@@ -100,12 +100,7 @@ typedef struct __GLXdisplayInfoHashRec {
 
 static DEFINE_INITIALIZED_LKDHASH(__GLXdisplayInfoHash, __glXDisplayInfoHash);
 
-struct __GLXvendorXIDMappingHashRec {
-    XID xid;
-    __GLXvendorInfo *vendor;
-    UT_hash_handle hh;
-};
-
+static void CleanupXIDVendorTable(__GLXdisplayInfo *dpyInfo);
 static __GLXextFuncPtr __glXFetchDispatchEntry(__GLXvendorInfo *vendor, int index);
 
 static const __GLXapiExports glxExportsTable = {
@@ -380,6 +375,23 @@ static void *VendorGetProcAddressCallback(const char *procName, void *param)
     return vendor->glxvc->getProcAddress((const GLubyte *) procName);
 }
 
+static GLboolean VendorGetProcAddressListCallback(const char * const *procNames,
+        int count, void **procs, void *param)
+{
+    __GLXvendorInfo *vendor = (__GLXvendorInfo *) param;
+
+    // The dispatch table is created before we call into the vendor's
+    // __glx_Main function, so we can't tell until now whether the vendor
+    // supports this.
+    if (vendor->glxvc->getProcAddressList == NULL) {
+        return GL_FALSE;
+    }
+
+    vendor->glxvc->getProcAddressList((const GLubyte * const *) procNames,
+            count, procs);
+    return GL_TRUE;
+}
+
 __GLXvendorInfo *__glXLookupVendorByName(const char *vendorName)
 {
     __GLXvendorNameHash *pEntry = NULL;
@@ -441,8 +453,9 @@ __GLXvendorInfo *__glXLookupVendorByName(const char *vendorName)
             assert(vendor->vendorID >= 0);
 
             vendor->glDispatch = (__GLdispatchTable *)
-                __glDispatchCreateTable(
+                __glDispatchCreateTableWithList(
                     VendorGetProcAddressCallback,
+                    VendorGetProcAddressListCallback,
                     vendor
                 );
             if (!vendor->glDispatch) {
@@ -483,6 +496,7 @@ __GLXvendorInfo *__glXLookupVendorByName(const char *vendorName)
                 pEntry->patchCallbacks.initiatePatch = pEntry->imports.initiatePatch;
                 pEntry->patchCallbacks.releasePatch = pEntry->imports.releasePatch;
                 pEntry->patchCallbacks.threadAttach = pEntry->imports.patchThreadAttach;
+                pEntry->patchCallbacks.isLivePatchSupported = pEntry->imports.isLivePatchSupported;
                 pEntry->vendor.patchCallbacks = &pEntry->patchCallbacks;
             }
 
@@ -607,6 +621,19 @@ __GLXvendorInfo *__glXGetDynDispatch(Display *dpy, const int screen)
     return vendor;
 }
 
+/*
+ * Every value of xidVendorGeneration comes from this counter, so that a new
+ * display can't end up with the same generation as an old one, even if it
+ * gets the same Display pointer. Zero is never used, so it doesn't match
+ * an empty cache entry.
+ */
+static unsigned int xidVendorGenerationCounter = 0;
+
+static unsigned int NextXIDVendorGeneration(void)
+{
+    return __sync_add_and_fetch(&xidVendorGenerationCounter, 1);
+}
+
 /**
  * Allocates and initializes a __GLXdisplayInfoHash structure.
  *
@@ -631,7 +658,7 @@ static __GLXdisplayInfoHash *InitDisplayInfoEntry(Display *dpy)
     pEntry->info.dpy = dpy;
     pEntry->info.vendors = (__GLXvendorInfo **) (pEntry + 1);
 
-    LKDHASH_INIT(pEntry->info.xidVendorHash);
+    pEntry->info.xidVendorGeneration = NextXIDVendorGeneration();
     __glvndPthreadFuncs.rwlock_init(&pEntry->info.vendorLock, NULL);
 
     // Check whether the server supports the GLX extension, and record the
@@ -685,8 +712,7 @@ static void CleanupDisplayInfoEntry(void *unused, __GLXdisplayInfoHash *pEntry)
         free(pEntry->info.clientStrings[i]);
     }
 
-    LKDHASH_TEARDOWN(__GLXvendorXIDMappingHash,
-                     pEntry->info.xidVendorHash, NULL, NULL, False);
+    CleanupXIDVendorTable(&pEntry->info);
 }
 
 static int OnDisplayClosed(Display *dpy, XExtCodes *codes)
@@ -856,13 +882,359 @@ __GLXvendorInfo *__glXVendorFromFBConfig(Display *dpy, GLXFBConfig config)
 
 /****************************************************************************/
 /*
- * __GLXvendorXIDMappingHash is a hash table which maps XIDs to vendors.
+ * Each display's XID to vendor mappings are kept in an open-addressing table,
+ * so that VendorFromXID can look up a drawable without taking any lock.
+ *
+ * Only the writers -- AddVendorXIDMapping, RemoveVendorXIDMapping, and
+ * CleanupXIDVendorTable -- take xidTableMutex. A writer only ever fills in an
+ * empty slot or changes the vendor in an existing one, so a reader will see
+ * either the old or the new mapping. Removing a mapping leaves the XID in its
+ * slot with a NULL vendor, so that lookups for other XIDs still probe past
+ * it.
+ *
+ * When a table fills up, the writer copies the remaining mappings into a new
+ * table and swaps the pointer. The old table can't be freed until every
+ * reader that might still be looking at it is done. Each reader stores the
+ * current xidTableEpoch in its thread state while it's looking at a table.
+ * Whenever a writer retires a table, it also frees any older tables that no
+ * reader has an epoch from before.
  */
 
+/// The smallest table that we'll allocate. This must be a power of two.
+#define XID_VENDOR_TABLE_MIN_SIZE 16
+
+struct __GLXvendorXIDTableRec {
+    /// The next table in retiredXIDTables.
+    struct __GLXvendorXIDTableRec *nextRetired;
+
+    /// The value of xidTableEpoch when this table was retired.
+    unsigned long retireEpoch;
+
+    unsigned int size; //< The number of slots. Always a power of two.
+    unsigned int used; //< The number of slots with an XID in them.
+    unsigned int count; //< The number of slots with a vendor in them.
+
+    struct {
+        volatile XID xid;
+        __GLXvendorInfo * volatile vendor;
+    } entries[];
+};
+
+/*
+ * A small per-thread cache of XID to vendor mappings. A rendering thread
+ * almost always uses the same one or two drawables, so this lets
+ * VendorFromXID skip the display's table on every frame.
+ *
+ * Each entry records the display's xidVendorGeneration from before the
+ * lookup, and it's only used if that still matches.
+ */
+#define XID_VENDOR_CACHE_SIZE 4
+
+typedef struct __GLXvendorXIDThreadStateRec {
+    /**
+     * The value of xidTableEpoch while this thread is looking at an XID
+     * table, or zero if it isn't.
+     */
+    volatile unsigned long epoch;
+
+    /// The entry in xidThreadStateList.
+    struct glvnd_list entry;
+
+    struct {
+        Display *dpy;
+        XID xid;
+        unsigned int generation;
+        __GLXvendorInfo *vendor;
+    } cache[XID_VENDOR_CACHE_SIZE];
+    int nextCache;
+} __GLXvendorXIDThreadState;
+
+/**
+ * Serializes all changes to the XID tables, retiredXIDTables, and
+ * xidThreadStateList.
+ */
+static glvnd_mutex_t xidTableMutex = GLVND_MUTEX_INITIALIZER;
+
+/// Incremented each time a table is retired. Zero is never used.
+static volatile unsigned long xidTableEpoch = 1;
+
+/// Tables that have been replaced, but that might still have readers.
+static __GLXvendorXIDTable *retiredXIDTables = NULL;
+
+/// A list of every __GLXvendorXIDThreadState.
+static struct glvnd_list xidThreadStateList;
+
+static glvnd_key_t xidThreadStateKey;
+
+static void FreeXIDThreadState(void *data)
+{
+    __GLXvendorXIDThreadState *state = (__GLXvendorXIDThreadState *) data;
+
+    __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
+    glvnd_list_del(&state->entry);
+    __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
+    free(state);
+}
+
+/**
+ * Returns the current thread's __GLXvendorXIDThreadState, creating it if
+ * necessary.
+ *
+ * \return The thread state, or NULL on malloc failure.
+ */
+static __GLXvendorXIDThreadState *GetXIDThreadState(void)
+{
+    __GLXvendorXIDThreadState *state = (__GLXvendorXIDThreadState *)
+        __glvndPthreadFuncs.getspecific(xidThreadStateKey);
+
+    if (state == NULL) {
+        state = (__GLXvendorXIDThreadState *) calloc(1, sizeof(*state));
+        if (state == NULL) {
+            return NULL;
+        }
+
+        __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
+        glvnd_list_add(&state->entry, &xidThreadStateList);
+        __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
+
+        __glvndPthreadFuncs.setspecific(xidThreadStateKey, state);
+    }
+    return state;
+}
+
+static unsigned int HashXID(XID xid)
+{
+    // The server hands out XIDs sequentially, so mix up the bits before we
+    // mask them off.
+    unsigned long long hash = ((unsigned long long) xid) * 0x9E3779B97F4A7C15ULL;
+    return (unsigned int) (hash >> 32);
+}
+
+/**
+ * Returns the slot that holds \p xid, or the empty slot where it would go.
+ *
+ * The caller must hold xidTableMutex.
+ */
+static unsigned int FindXIDTableSlot(const __GLXvendorXIDTable *table, XID xid)
+{
+    unsigned int mask = table->size - 1;
+    unsigned int i = HashXID(xid) & mask;
+
+    while (table->entries[i].xid != xid && table->entries[i].xid != None) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/**
+ * Looks up the vendor for \p xid.
+ *
+ * This doesn't take any lock, so it's safe to call while another thread is
+ * changing the table.
+ */
+static __GLXvendorInfo *FindXIDTableVendor(const __GLXvendorXIDTable *table, XID xid)
+{
+    unsigned int mask, i;
+
+    if (table == NULL) {
+        return NULL;
+    }
+
+    mask = table->size - 1;
+    for (i = HashXID(xid) & mask; ; i = (i + 1) & mask) {
+        XID slotXID = table->entries[i].xid;
+        if (slotXID == xid) {
+            // The vendor is written before the XID, so make sure we don't
+            // read the vendor from before then.
+            __sync_synchronize();
+            return table->entries[i].vendor;
+        } else if (slotXID == None) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Adds \p table to retiredXIDTables, and frees any retired tables that no
+ * reader can still be using.
+ *
+ * The caller must hold xidTableMutex, and must have already replaced any
+ * pointer to \p table.
+ *
+ * \param table The table to retire, or NULL to just free old tables.
+ */
+static void RetireXIDTable(__GLXvendorXIDTable *table)
+{
+    __GLXvendorXIDThreadState *state;
+    __GLXvendorXIDTable **prev;
+    unsigned long minEpoch;
+
+    if (table != NULL) {
+        table->retireEpoch = xidTableEpoch;
+        table->nextRetired = retiredXIDTables;
+        retiredXIDTables = table;
+
+        // A reader that sees the new epoch is guaranteed to also see the new
+        // table pointer, so it can't be using this table.
+        __sync_synchronize();
+        xidTableEpoch++;
+        __sync_synchronize();
+    }
+
+    minEpoch = xidTableEpoch;
+    glvnd_list_for_each_entry(state, &xidThreadStateList, entry) {
+        unsigned long epoch = state->epoch;
+        if (epoch != 0 && epoch < minEpoch) {
+            minEpoch = epoch;
+        }
+    }
+
+    prev = &retiredXIDTables;
+    while (*prev != NULL) {
+        __GLXvendorXIDTable *retired = *prev;
+        if (retired->retireEpoch < minEpoch) {
+            *prev = retired->nextRetired;
+            free(retired);
+        } else {
+            prev = &retired->nextRetired;
+        }
+    }
+}
+
+/**
+ * Replaces a display's XID table with a new one that has room for at least
+ * one more mapping.
+ *
+ * The caller must hold xidTableMutex.
+ *
+ * \return The new table, or NULL on malloc failure.
+ */
+static __GLXvendorXIDTable *ResizeXIDTable(__GLXdisplayInfo *dpyInfo)
+{
+    __GLXvendorXIDTable *oldTable = dpyInfo->xidVendorTable;
+    __GLXvendorXIDTable *newTable;
+    unsigned int count = (oldTable != NULL ? oldTable->count : 0);
+    unsigned int size = XID_VENDOR_TABLE_MIN_SIZE;
+    unsigned int i;
+
+    // Leave the new table at most half full, so that we don't have to
+    // resize it again right away.
+    while ((count + 1) * 2 > size) {
+        size *= 2;
+    }
+
+    newTable = (__GLXvendorXIDTable *) calloc(1, sizeof(*newTable)
+            + size * sizeof(newTable->entries[0]));
+    if (newTable == NULL) {
+        return NULL;
+    }
+    newTable->size = size;
+
+    if (oldTable != NULL) {
+        // Copy over the current mappings. Anything that was removed gets
+        // dropped here.
+        for (i=0; i<oldTable->size; i++) {
+            if (oldTable->entries[i].vendor != NULL) {
+                unsigned int slot = FindXIDTableSlot(newTable, oldTable->entries[i].xid);
+                newTable->entries[slot].xid = oldTable->entries[i].xid;
+                newTable->entries[slot].vendor = oldTable->entries[i].vendor;
+            }
+        }
+        newTable->used = newTable->count = count;
+    }
+
+    // Make sure the entries are visible before the table is.
+    __sync_synchronize();
+    dpyInfo->xidVendorTable = newTable;
+
+    RetireXIDTable(oldTable);
+    return newTable;
+}
+
+/**
+ * Retires a display's XID table. This is called when the display is closed.
+ */
+static void CleanupXIDVendorTable(__GLXdisplayInfo *dpyInfo)
+{
+    __GLXvendorXIDTable *table;
+
+    __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
+    table = dpyInfo->xidVendorTable;
+    dpyInfo->xidVendorTable = NULL;
+    RetireXIDTable(table);
+    __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
+}
+
+/**
+ * Looks up the vendor for \p xid in the display's table.
+ *
+ * \param state The current thread's state, or NULL if we couldn't allocate
+ * one.
+ */
+static __GLXvendorInfo *LookupXIDVendor(__GLXdisplayInfo *dpyInfo, XID xid,
+        __GLXvendorXIDThreadState *state)
+{
+    __GLXvendorInfo *vendor;
+
+    if (state != NULL) {
+        state->epoch = xidTableEpoch;
+
+        // The epoch has to be visible before we load the table pointer, or
+        // a writer could free the table out from under us.
+        __sync_synchronize();
+        vendor = FindXIDTableVendor(dpyInfo->xidVendorTable, xid);
+        __sync_synchronize();
+
+        state->epoch = 0;
+    } else {
+        // Without a thread state, the writers can't tell that we're here, so
+        // fall back to taking the lock.
+        __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
+        vendor = FindXIDTableVendor(dpyInfo->xidVendorTable, xid);
+        __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
+    }
+    return vendor;
+}
+
+static __GLXvendorInfo *LookupCachedXIDVendor(__GLXvendorXIDThreadState *state,
+        Display *dpy, XID xid, unsigned int generation)
+{
+    int i;
+
+    if (state != NULL) {
+        for (i=0; i<XID_VENDOR_CACHE_SIZE; i++) {
+            if (state->cache[i].xid == xid && state->cache[i].dpy == dpy
+                    && state->cache[i].generation == generation) {
+                return state->cache[i].vendor;
+            }
+        }
+    }
+    return NULL;
+}
+
+static void AddCachedXIDVendor(__GLXvendorXIDThreadState *state,
+        Display *dpy, XID xid, unsigned int generation, __GLXvendorInfo *vendor)
+{
+    int i;
+
+    if (state == NULL) {
+        return;
+    }
+
+    i = state->nextCache;
+    state->nextCache = (i + 1) % XID_VENDOR_CACHE_SIZE;
+    state->cache[i].dpy = dpy;
+    state->cache[i].xid = xid;
+    state->cache[i].generation = generation;
+    state->cache[i].vendor = vendor;
+}
+
 
 static int AddVendorXIDMapping(Display *dpy, __GLXdisplayInfo *dpyInfo, XID xid, __GLXvendorInfo *vendor)
 {
-    __GLXvendorXIDMappingHash *pEntry = NULL;
+    __GLXvendorXIDTable *table;
+    unsigned int i = 0;
+    int ret = 0;
 
     if (xid == None) {
         return 0;
@@ -872,70 +1244,96 @@ static int AddVendorXIDMapping(Display *dpy, __GLXdisplayInfo *dpyInfo, XID xid,
         return -1;
     }
 
-    LKDHASH_WRLOCK(dpyInfo->xidVendorHash);
+    __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
 
-    HASH_FIND(hh, _LH(dpyInfo->xidVendorHash), &xid, sizeof(xid), pEntry);
+    table = dpyInfo->xidVendorTable;
+    if (table != NULL) {
+        i = FindXIDTableSlot(table, xid);
+    }
 
-    if (pEntry == NULL) {
-        pEntry = malloc(sizeof(*pEntry));
-        if (pEntry == NULL) {
-            LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
-            return -1;
-        }
-        pEntry->xid = xid;
-        pEntry->vendor = vendor;
-        HASH_ADD(hh, _LH(dpyInfo->xidVendorHash), xid, sizeof(xid), pEntry);
-    } else {
+    if (table != NULL && table->entries[i].vendor != NULL) {
         // Like GLXContext and GLXFBConfig handles, any GLXDrawables must map
         // to a single vendor library.
-        if (pEntry->vendor != vendor) {
-            LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
-            return -1;
+        if (table->entries[i].vendor != vendor) {
+            ret = -1;
+        }
+    } else if (table != NULL && table->entries[i].xid == xid) {
+        // The XID was removed earlier, so just reuse its slot.
+        table->entries[i].vendor = vendor;
+        table->count++;
+    } else {
+        if (table == NULL || (table->used + 1) * 4 > table->size * 3) {
+            table = ResizeXIDTable(dpyInfo);
+            if (table != NULL) {
+                i = FindXIDTableSlot(table, xid);
+            }
+        }
+
+        if (table != NULL) {
+            // Fill in the vendor first, so that a reader that finds the XID
+            // will also find the vendor.
+            table->entries[i].vendor = vendor;
+            __sync_synchronize();
+            table->entries[i].xid = xid;
+            table->used++;
+            table->count++;
+        } else {
+            ret = -1;
         }
     }
 
-    LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
-    return 0;
+    __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
+    return ret;
 }
 
 
 static void RemoveVendorXIDMapping(Display *dpy, __GLXdisplayInfo *dpyInfo, XID xid)
 {
-    __GLXvendorXIDMappingHash *pEntry;
+    __GLXvendorXIDTable *table;
+    unsigned int i;
 
     if (xid == None) {
         return;
     }
 
-    LKDHASH_WRLOCK(dpyInfo->xidVendorHash);
+    __glvndPthreadFuncs.mutex_lock(&xidTableMutex);
 
-    HASH_FIND(hh, _LH(dpyInfo->xidVendorHash), &xid, sizeof(xid), pEntry);
+    table = dpyInfo->xidVendorTable;
+    if (table != NULL) {
+        i = FindXIDTableSlot(table, xid);
+        if (table->entries[i].xid == xid && table->entries[i].vendor != NULL) {
+            table->entries[i].vendor = NULL;
+            table->count--;
 
-    if (pEntry != NULL) {
-        HASH_DELETE(hh, _LH(dpyInfo->xidVendorHash), pEntry);
-        free(pEntry);
+            // This has to happen after the entry is gone, so that another
+            // thread can't find the old entry and then cache it with the new
+            // generation.
+            dpyInfo->xidVendorGeneration = NextXIDVendorGeneration();
+        }
     }
 
-    LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
+    __glvndPthreadFuncs.mutex_unlock(&xidTableMutex);
 }
 
 
 static void VendorFromXID(Display *dpy, __GLXdisplayInfo *dpyInfo, XID xid,
         __GLXvendorInfo **retVendor)
 {
-    __GLXvendorXIDMappingHash *pEntry;
+    __GLXvendorXIDThreadState *state = GetXIDThreadState();
     __GLXvendorInfo *vendor = NULL;
+    unsigned int generation = dpyInfo->xidVendorGeneration;
 
-    LKDHASH_RDLOCK(dpyInfo->xidVendorHash);
+    vendor = LookupCachedXIDVendor(state, dpy, xid, generation);
+    if (vendor != NULL) {
+        if (retVendor != NULL) {
+            *retVendor = vendor;
+        }
+        return;
+    }
 
-    HASH_FIND(hh, _LH(dpyInfo->xidVendorHash), &xid, sizeof(xid), pEntry);
-
-    if (pEntry) {
-        vendor = pEntry->vendor;
-        LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
-    } else {
-        LKDHASH_UNLOCK(dpyInfo->xidVendorHash);
+    vendor = LookupXIDVendor(dpyInfo, xid, state);
 
+    if (vendor == NULL) {
         if (dpyInfo->libglvndExtensionSupported) {
             int screen = __glXGetDrawableScreen(dpyInfo, xid);
             if (screen >= 0 && screen < ScreenCount(dpy)) {
@@ -949,6 +1347,10 @@ static void VendorFromXID(Display *dpy, __GLXdisplayInfo *dpyInfo, XID xid,
         }
     }
 
+    if (vendor != NULL) {
+        AddCachedXIDVendor(state, dpy, xid, generation, vendor);
+    }
+
     if (retVendor != NULL) {
         *retVendor = vendor;
     }
@@ -998,6 +1400,8 @@ void __glXMappingInit(void)
     int i;
 
     __glvndWinsysDispatchInit();
+    glvnd_list_init(&xidThreadStateList);
+    __glvndPthreadFuncs.key_create(&xidThreadStateKey, FreeXIDThreadState);
 
     // Add all of the GLX dispatch stubs that are defined in libGLX itself.
     for (i=0; LOCAL_GLX_DISPATCH_FUNCTIONS[i].name != NULL; i++) {
@@ -1017,6 +1421,9 @@ void __glXMappingTeardown(Bool doReset)
 
     if (doReset) {
         __GLXdisplayInfoHash *dpyInfoEntry, *dpyInfoTmp;
+        __GLXvendorXIDThreadState *state, *stateTmp;
+        __GLXvendorXIDThreadState *currentState = (__GLXvendorXIDThreadState *)
+            __glvndPthreadFuncs.getspecific(xidThreadStateKey);
 
         /*
          * If we're just doing fork recovery, we don't actually want to unload
@@ -1028,9 +1435,18 @@ void __glXMappingTeardown(Bool doReset)
         __glvndPthreadFuncs.rwlock_init(&fbconfigHashtable.lock, NULL);
         __glvndPthreadFuncs.rwlock_init(&__glXVendorNameHash.lock, NULL);
         __glvndPthreadFuncs.rwlock_init(&__glXDisplayInfoHash.lock, NULL);
+        __glvndPthreadFuncs.mutex_init(&xidTableMutex, NULL);
+
+        // Only the current thread survives the fork, so nothing else can be
+        // reading an XID table.
+        glvnd_list_for_each_entry_safe(state, stateTmp, &xidThreadStateList, entry) {
+            if (state != currentState) {
+                glvnd_list_del(&state->entry);
+                free(state);
+            }
+        }
 
         HASH_ITER(hh, _LH(__glXDisplayInfoHash), dpyInfoEntry, dpyInfoTmp) {
-            __glvndPthreadFuncs.rwlock_init(&dpyInfoEntry->info.xidVendorHash.lock, NULL);
             __glvndPthreadFuncs.rwlock_init(&dpyInfoEntry->info.vendorLock, NULL);
         }
     } else {
@@ -1053,6 +1469,21 @@ void __glXMappingTeardown(Bool doReset)
         LKDHASH_TEARDOWN(__GLXdisplayInfoHash,
                          __glXDisplayInfoHash, CleanupDisplayInfoEntry,
                          NULL, False);
+
+        // Every display is gone now, so free the retired XID tables and the
+        // thread states, even if their threads are still running.
+        __glvndPthreadFuncs.key_delete(xidThreadStateKey);
+        while (retiredXIDTables != NULL) {
+            __GLXvendorXIDTable *table = retiredXIDTables;
+            retiredXIDTables = table->nextRetired;
+            free(table);
+        }
+        while (!glvnd_list_is_empty(&xidThreadStateList)) {
+            __GLXvendorXIDThreadState *state = glvnd_list_first_entry(
+                    &xidThreadStateList, __GLXvendorXIDThreadState, entry);
+            glvnd_list_del(&state->entry);
+            free(state);
+        }
         /*
          * This implicitly unloads vendor libraries that were loaded when
          * they were added to this hashtable.
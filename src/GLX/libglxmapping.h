@@ -55,7 +55,7 @@ struct __GLXvendorInfoRec {
     __GLXdispatchTableStatic staticDispatch; //< static GLX dispatch table
 };
 
-typedef struct __GLXvendorXIDMappingHashRec __GLXvendorXIDMappingHash;
+typedef struct __GLXvendorXIDTableRec __GLXvendorXIDTable;
 
 /*!
  * Structure containing per-display information.
@@ -73,7 +73,17 @@ typedef struct __GLXdisplayInfoRec {
     __GLXvendorInfo **vendors;
     glvnd_rwlock_t vendorLock;
 
-    DEFINE_LKDHASH(__GLXvendorXIDMappingHash, xidVendorHash);
+    /**
+     * The XID to vendor mappings for drawables. Readers don't take any lock;
+     * see the comments in libglxmapping.c.
+     */
+    __GLXvendorXIDTable * volatile xidVendorTable;
+
+    /**
+     * Changes whenever a mapping is removed from \c xidVendorTable, so that
+     * the per-thread drawable caches know to throw out their entries.
+     */
+    volatile unsigned int xidVendorGeneration;
 
     /// True if the server supports the GLX extension.
     Bool glxSupported;
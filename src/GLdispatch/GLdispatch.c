@@ -28,23 +28,32 @@
  */
 
 #include <string.h>
+#include <stdio.h>
+#include <time.h>
 #include <pthread.h>
 #include <dlfcn.h>
+#include <sys/mman.h>
 
 #include "trace.h"
 #include "glvnd_list.h"
 #include "GLdispatch.h"
 #include "GLdispatchPrivate.h"
+#include "GLdispatchCache.h"
 #include "stub.h"
 #include "glvnd_pthread.h"
 #include "app_error_check.h"
+#include "utils_misc.h"
 
 /*
- * Global current dispatch table list. We need this to fix up all current
- * dispatch tables whenever GetProcAddress() is called on a new function.
+ * Global dispatch table list. We need this to fix up all current dispatch
+ * tables whenever GetProcAddress() is called on a new function.
+ *
+ * Tables are added when they're created and removed when they're destroyed,
+ * so making a table current only changes its currentThreads count. A table
+ * can outlive __glDispatchFini, so this is never reinitialized.
  * Accesses to this need to be protected by the dispatch lock.
  */
-static struct glvnd_list currentDispatchList;
+static struct glvnd_list dispatchTableList = { &dispatchTableList, &dispatchTableList };
 
 /*
  * Number of clients using GLdispatch.
@@ -56,6 +65,21 @@ static int clientRefcount;
  */
 static int numCurrentContexts;
 
+/*
+ * The number of current contexts for each vendor. If every other current
+ * context belongs to the same vendor, then that vendor can patch the
+ * entrypoints without waiting for the other threads.
+ *
+ * Entries are allocated in __glDispatchNewVendorID, so that MakeCurrent and
+ * LoseCurrent only change the counts. They're only freed in __glDispatchFini.
+ */
+typedef struct __GLdispatchVendorContextsRec {
+    int vendorID;
+    int count;
+    struct glvnd_list entry;
+} __GLdispatchVendorContexts;
+static struct glvnd_list currentVendorList;
+
 /**
  * Private data for each API state.
  */
@@ -98,6 +122,69 @@ static int localDispatchStubId = -1;
  */
 static GLint64 dispatchStubListGeneration;
 
+/**
+ * A registered dispatch layer.
+ */
+struct __GLdispatchLayerRec {
+    __GLdispatchLayerGetProcCallback getProcAddress;
+    void *param;
+
+    /// The layer's function for each slot, or NULL for the slots that it
+    /// passes through. This is filled in up to \c procsPopulated.
+    void **procs;
+    int procsPopulated;
+
+    /// The index of this layer's table in __GLdispatchTable::layerTables.
+    int index;
+
+    struct glvnd_list entry;
+};
+
+/*
+ * The registered dispatch layers, starting with the innermost one. Accesses to
+ * this need to be protected by the dispatch lock.
+ */
+static struct glvnd_list layerList;
+static int numLayers;
+
+/*
+ * Incremented whenever a layer is added or removed, so that
+ * FixupDispatchTable knows to rebuild each table's layers.
+ */
+static int layerGeneration;
+
+/**
+ * The call counts for a single thread.
+ */
+typedef struct __GLdispatchCallCountsRec {
+    struct glvnd_list entry;
+
+    /// The number of calls to each slot, indexed by slot number.
+    GLuint64 counts[];
+} __GLdispatchCallCounts;
+
+/*
+ * The layer that counts calls, or NULL if call counting isn't enabled.
+ */
+static __GLdispatchLayer *countLayer;
+
+/*
+ * The call counts for each thread. Each thread only updates its own counts,
+ * without taking any lock, and __glDispatchGetCallCounts adds them up.
+ * Accesses to the list itself need to be protected by the dispatch lock.
+ */
+static struct glvnd_list callCountsList;
+
+/*
+ * The call counts from threads that have already terminated.
+ */
+static GLuint64 *retiredCallCounts;
+
+/**
+ * The key used to store the __GLdispatchCallCounts for the current thread.
+ */
+static glvnd_key_t threadCallCountsKey;
+
 /*
  * Used when generating new vendor IDs for GLdispatch clients.  Valid vendor
  * IDs must be non-zero.
@@ -109,9 +196,34 @@ static int firstUnusedVendorID = 1;
  */
 static glvnd_key_t threadContextKey;
 
+/**
+ * The key used to flag whether the current thread has already gone through
+ * \c __glDispatchCheckMultithreaded. The value is non-NULL once the thread has
+ * been attached.
+ */
+static glvnd_key_t threadAttachedKey;
+
+/**
+ * The key used to store an unused __GLdispatchThreadStatePrivate struct for
+ * the current thread. __glDispatchLoseCurrent leaves the private struct here,
+ * and the next __glDispatchMakeCurrent call on the same thread reuses it, so
+ * that switching contexts doesn't need to allocate anything.
+ */
+static glvnd_key_t threadSparePrivKey;
+
 static void SetCurrentThreadState(__GLdispatchThreadState *threadState);
 static void ThreadDestroyed(void *data);
 static int RegisterStubCallbacks(const __GLdispatchStubPatchCallbacks *callbacks);
+static _glapi_proc ResolveLazySlot(int slot);
+static __GLdispatchLayer *AddLayer(__GLdispatchLayerGetProcCallback getProcAddress,
+        void *param);
+static GLboolean CallCountingIsEnabledByEnvVar(void);
+static void *CountLayerGetProc(const char *procName, int slot, void *param);
+static _glapi_proc CountSlot(int slot);
+static void ThreadCallCountsDestroyed(void *data);
+static void CleanupCallCounts(void);
+static void StopDirectDispatch(void);
+static __GLdispatchVendorContexts *CreateVendorContexts(int vendorID);
 
 
 /*
@@ -126,8 +238,50 @@ static int stubOwnerVendorID;
  */
 static const __GLdispatchPatchCallbacks *stubCurrentPatchCb;
 
+/*
+ * If this is set, then FixupDispatchTable will fill in the slots for existing
+ * stubs with resolver stubs instead of looking up every function up front.
+ */
+static GLboolean lazyDispatch = GL_FALSE;
+
+/*
+ * If this is set, then while only one dispatch table has ever been current,
+ * the entrypoints jump straight to the functions in that table instead of
+ * going through the current thread's table. See UpdateDirectDispatch.
+ */
+static GLboolean directDispatch = GL_FALSE;
+
+/*
+ * The first dispatch table that was made current, and its vendor ID.
+ */
+static __GLdispatchTable *firstCurrentDispatch;
+static int firstCurrentVendorID;
+
+/*
+ * Set once any other dispatch table has been current, after which we never
+ * use direct dispatch again.
+ */
+static GLboolean multipleCurrentDispatch = GL_FALSE;
+
+/*
+ * Set while any entrypoints are redirected to firstCurrentDispatch.
+ */
+static GLboolean directDispatchActive = GL_FALSE;
+
+/*
+ * The value of dispatchStubListGeneration as of the last time we tried to
+ * redirect the entrypoints.
+ */
+static GLint64 directDispatchGeneration = -1;
+
 static glvnd_thread_t firstThreadId = GLVND_THREAD_NULL_INIT;
-static int isMultiThreaded = 0;
+
+/*
+ * Set to non-zero once a second thread has called into GLX or EGL. This is
+ * only ever written with the dispatch lock held, but it's read without the
+ * lock in __glDispatchCheckMultithreaded.
+ */
+static volatile int isMultiThreaded = 0;
 
 /*
  * The dispatch lock. This should be taken around any code that manipulates the
@@ -139,9 +293,96 @@ struct {
     int isLocked;
 } dispatchLock = { GLVND_MUTEX_INITIALIZER, 0 };
 
+/**
+ * The statistics for a single thread.
+ */
+typedef struct __GLdispatchThreadStatsRec {
+    __GLdispatchStats stats;
+    struct glvnd_list entry;
+} __GLdispatchThreadStats;
+
+/*
+ * The statistics for each thread. Each thread only updates its own counters,
+ * without taking any lock, and __glDispatchGetStats adds them up.
+ *
+ * The list has its own lock, since the dispatch lock itself is one of the
+ * things that we keep track of.
+ */
+static struct glvnd_list threadStatsList = { &threadStatsList, &threadStatsList };
+static glvnd_mutex_t threadStatsLock = GLVND_MUTEX_INITIALIZER;
+
+/*
+ * The statistics from threads that have already terminated.
+ */
+static __GLdispatchStats retiredStats;
+
+/**
+ * The key used to store the __GLdispatchThreadStats for the current thread.
+ * This is only valid while threadStatsKeyCreated is set.
+ */
+static glvnd_key_t threadStatsKey;
+static int threadStatsKeyCreated;
+
+/**
+ * Returns the statistics for the current thread, or NULL if they're not
+ * available.
+ */
+static __GLdispatchStats *GetThreadStats(void)
+{
+    __GLdispatchThreadStats *threadStats;
+
+    if (!threadStatsKeyCreated) {
+        return NULL;
+    }
+
+    threadStats = (__GLdispatchThreadStats *)
+        __glvndPthreadFuncs.getspecific(threadStatsKey);
+    if (threadStats == NULL) {
+        threadStats = (__GLdispatchThreadStats *)
+            calloc(1, sizeof(__GLdispatchThreadStats));
+        if (threadStats == NULL) {
+            return NULL;
+        }
+        __glvndPthreadFuncs.mutex_lock(&threadStatsLock);
+        glvnd_list_append(&threadStats->entry, &threadStatsList);
+        __glvndPthreadFuncs.mutex_unlock(&threadStatsLock);
+        __glvndPthreadFuncs.setspecific(threadStatsKey, threadStats);
+    }
+    return &threadStats->stats;
+}
+
+#define ADD_STAT(field, value) \
+    do { \
+        __GLdispatchStats *_stats = GetThreadStats(); \
+        if (_stats != NULL) { \
+            _stats->field += (value); \
+        } \
+    } while (0)
+
+static inline GLuint64 GetTimeNanoseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((GLuint64) ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
 static inline void LockDispatch(void)
 {
-    __glvndPthreadFuncs.mutex_lock(&dispatchLock.lock);
+    __GLdispatchStats *stats = GetThreadStats();
+
+    if (__glvndPthreadFuncs.mutex_trylock(&dispatchLock.lock) != 0) {
+        // Only check the time if some other thread has the lock, so that the
+        // uncontended case stays cheap.
+        GLuint64 start = GetTimeNanoseconds();
+        __glvndPthreadFuncs.mutex_lock(&dispatchLock.lock);
+        if (stats != NULL) {
+            stats->lockContendedCount++;
+            stats->lockContendedNanoseconds += GetTimeNanoseconds() - start;
+        }
+    }
+    if (stats != NULL) {
+        stats->lockCount++;
+    }
     dispatchLock.isLocked = 1;
 }
 
@@ -170,6 +411,57 @@ void _init(void)
     glvndAppErrorCheckInit();
 }
 
+/**
+ * Adds the counters in \p src to \p dst.
+ */
+static void AccumulateStats(__GLdispatchStats *dst, const __GLdispatchStats *src)
+{
+    // Every member of __GLdispatchStats is a GLuint64 counter.
+    GLuint64 *d = (GLuint64 *) dst;
+    const GLuint64 *s = (const GLuint64 *) src;
+    size_t i;
+
+    for (i=0; i<sizeof(__GLdispatchStats) / sizeof(GLuint64); i++) {
+        d[i] += s[i];
+    }
+}
+
+PUBLIC void __glDispatchGetStats(__GLdispatchStats *stats)
+{
+    __GLdispatchThreadStats *threadStats;
+
+    __glvndPthreadFuncs.mutex_lock(&threadStatsLock);
+    *stats = retiredStats;
+    glvnd_list_for_each_entry(threadStats, &threadStatsList, entry) {
+        AccumulateStats(stats, &threadStats->stats);
+    }
+    __glvndPthreadFuncs.mutex_unlock(&threadStatsLock);
+}
+
+static GLboolean LazyDispatchIsEnabledByEnvVar(void)
+{
+    const char *str = getenv("__GLVND_LAZY_DISPATCH");
+    return (str != NULL && atoi(str) != 0);
+}
+
+static GLboolean DirectDispatchIsEnabledByEnvVar(void)
+{
+    const char *str = getenv("__GLVND_DIRECT_DISPATCH");
+    return (str != NULL && atoi(str) != 0);
+}
+
+static void ThreadStatsDestroyed(void *data)
+{
+    __GLdispatchThreadStats *threadStats = (__GLdispatchThreadStats *) data;
+
+    __glvndPthreadFuncs.mutex_lock(&threadStatsLock);
+    AccumulateStats(&retiredStats, &threadStats->stats);
+    glvnd_list_del(&threadStats->entry);
+    __glvndPthreadFuncs.mutex_unlock(&threadStatsLock);
+
+    free(threadStats);
+}
+
 void __glDispatchInit(void)
 {
     LockDispatch();
@@ -177,11 +469,48 @@ void __glDispatchInit(void)
     if (clientRefcount == 0) {
         // Initialize the GLAPI layer.
         _glapi_init();
+        if (__glvndPthreadFuncs.key_create(&threadStatsKey, ThreadStatsDestroyed) == 0) {
+            threadStatsKeyCreated = 1;
+        }
         __glvndPthreadFuncs.key_create(&threadContextKey, ThreadDestroyed);
+        __glvndPthreadFuncs.key_create(&threadAttachedKey, NULL);
+        __glvndPthreadFuncs.key_create(&threadSparePrivKey, free);
+
+        // The resolver stubs are always used for slots that don't have a
+        // dispatch stub yet, so that __glDispatchGetProcAddress doesn't have
+        // to update every current dispatch table when it generates a new
+        // stub. With lazy dispatch, they're used for every other slot, too.
+        _glapi_set_resolve_callback(ResolveLazySlot);
+        lazyDispatch = LazyDispatchIsEnabledByEnvVar();
+        directDispatch = DirectDispatchIsEnabledByEnvVar();
 
         glvnd_list_init(&extProcList);
-        glvnd_list_init(&currentDispatchList);
+        glvnd_list_init(&currentVendorList);
         glvnd_list_init(&dispatchStubList);
+        glvnd_list_init(&layerList);
+        glvnd_list_init(&callCountsList);
+
+        // Call counting is implemented as a layer, so that it doesn't cost
+        // anything unless it's enabled. It's added before any other layers,
+        // so it only counts the calls that make it to the vendor library.
+        if (CallCountingIsEnabledByEnvVar()) {
+            _glapi_set_count_callback(CountSlot);
+            if (_glapi_get_count_thunk(0) != NULL) {
+                retiredCallCounts = (GLuint64 *)
+                    calloc(_glapi_get_dispatch_table_size(), sizeof(GLuint64));
+                if (retiredCallCounts != NULL) {
+                    countLayer = AddLayer(CountLayerGetProc, NULL);
+                }
+            }
+            if (countLayer != NULL) {
+                __glvndPthreadFuncs.key_create(&threadCallCountsKey,
+                        ThreadCallCountsDestroyed);
+            } else {
+                free(retiredCallCounts);
+                retiredCallCounts = NULL;
+                _glapi_set_count_callback(NULL);
+            }
+        }
 
         // Register GLdispatch's static entrypoints for rewriting
         localDispatchStubId = RegisterStubCallbacks(stub_get_patch_callbacks());
@@ -197,6 +526,8 @@ int __glDispatchNewVendorID(void)
 
     LockDispatch();
     vendorID = firstUnusedVendorID++;
+    // If this fails, then AddVendorContext will try again.
+    CreateVendorContexts(vendorID);
     UnlockDispatch();
 
     return vendorID;
@@ -207,120 +538,1039 @@ static void noop_func(void)
     // nop
 }
 
+/*
+ * A block of huge pages that dispatch tables get carved out of.
+ *
+ * If huge pages are enabled, then we pack the dispatch tables together in
+ * arenas instead of giving each one its own mapping, so that every table
+ * shares a handful of TLB entries.
+ */
+typedef struct __GLdispatchTableArenaRec {
+    struct __GLdispatchTableArenaRec *next;
+    char *base;
+    size_t used;
+} __GLdispatchTableArena;
+
+static __GLdispatchTableArena *tableArenas;
+
+/*
+ * Tables in the arenas that have been freed, linked through the first
+ * pointer in each table.
+ */
+static void **freeArenaTables;
+
+static size_t GetArenaTableSize(void)
+{
+    // Keep each table aligned to a cache line.
+    return (_glapi_get_dispatch_table_bytes() + 63) & ~((size_t) 63);
+}
+
+static __GLdispatchTableArena *FindTableArena(const void *table)
+{
+    __GLdispatchTableArena *arena;
+    size_t arenaSize = GetHugePageSize();
+
+    for (arena = tableArenas; arena != NULL; arena = arena->next) {
+        if ((const char *) table >= arena->base
+                && (const char *) table < arena->base + arenaSize) {
+            return arena;
+        }
+    }
+    return NULL;
+}
+
+static void *AllocArenaTable(void)
+{
+    __GLdispatchTableArena *arena = tableArenas;
+    size_t arenaSize = GetHugePageSize();
+    size_t tableSize = GetArenaTableSize();
+    void *table;
+
+    CheckDispatchLocked();
+
+    if (freeArenaTables != NULL) {
+        table = freeArenaTables;
+        freeArenaTables = (void **) freeArenaTables[0];
+        memset(table, 0, tableSize);
+        return table;
+    }
+
+    if (arena == NULL || arena->used + tableSize > arenaSize) {
+        arena = malloc(sizeof(*arena));
+        if (arena == NULL) {
+            return NULL;
+        }
+        arena->base = AllocHugePages(arenaSize);
+        if (arena->base == NULL) {
+            free(arena);
+            return NULL;
+        }
+        arena->used = 0;
+        arena->next = tableArenas;
+        tableArenas = arena;
+    }
+
+    table = arena->base + arena->used;
+    arena->used += tableSize;
+    return table;
+}
+
+static void FreeTableArenas(void)
+{
+    CheckDispatchLocked();
+
+    while (tableArenas != NULL) {
+        __GLdispatchTableArena *arena = tableArenas;
+        tableArenas = arena->next;
+        munmap(arena->base, GetHugePageSize());
+        free(arena);
+    }
+    freeArenaTables = NULL;
+}
+
+/**
+ * Allocates the memory for a dispatch table, or for a layer's copy of one.
+ *
+ * The table has room for every dynamic slot, but most of those slots are
+ * never used. We only ever write to the slots up to the current stub count,
+ * so using an anonymous mapping means that the rest of the table doesn't take
+ * up any memory until a stub gets generated for it. With sparse tables, the
+ * table only covers the static slots, and _glapi_reserve_table_slots
+ * allocates the dynamic slots separately.
+ *
+ * If huge pages are enabled, then the table comes from an arena instead,
+ * which trades that memory for fewer TLB misses.
+ */
+static struct _glapi_table *AllocDispatchTableMemory(void)
+{
+    void *ptr;
+
+    if (GetHugePageSize() >= GetArenaTableSize()) {
+        ptr = AllocArenaTable();
+        if (ptr != NULL) {
+            return (struct _glapi_table *) ptr;
+        }
+    }
+
+    ptr = mmap(NULL, _glapi_get_dispatch_table_bytes(),
+            PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+        return NULL;
+    }
+    return (struct _glapi_table *) ptr;
+}
+
+static void FreeDispatchTableMemory(struct _glapi_table *table)
+{
+    if (table != NULL) {
+        _glapi_release_table_slots(table);
+        if (FindTableArena(table) != NULL) {
+            void **entry = (void **) table;
+            entry[0] = freeArenaTables;
+            freeArenaTables = entry;
+        } else {
+            munmap(table, _glapi_get_dispatch_table_bytes());
+        }
+    }
+}
+
 static void DispatchCurrentRef(__GLdispatchTable *dispatch)
 {
     CheckDispatchLocked();
     dispatch->currentThreads++;
-    if (dispatch->currentThreads == 1) {
-        glvnd_list_add(&dispatch->entry, &currentDispatchList);
+}
+
+static void DispatchCurrentUnref(__GLdispatchTable *dispatch)
+{
+    CheckDispatchLocked();
+    dispatch->currentThreads--;
+    assert(dispatch->currentThreads >= 0);
+}
+
+/**
+ * Fills in the dispatch table entries from \c dispatch->stubsPopulated up to
+ * \p count using the vendor's getProcAddressList callback, if it has one.
+ *
+ * \return GL_TRUE if the entries were filled in, or GL_FALSE if the caller
+ * should fall back to looking up each function individually.
+ */
+static GLboolean FixupDispatchTableFromList(__GLdispatchTable *dispatch, int count)
+{
+    int first = dispatch->stubsPopulated;
+    const char **names;
+    void **procs;
+    GLboolean success;
+    int i;
+
+    CheckDispatchLocked();
+
+    if (dispatch->getProcAddressList == NULL) {
+        return GL_FALSE;
+    }
+
+    // The slots aren't necessarily contiguous in the table, so look up the
+    // functions into a separate array first.
+    names = (const char **) malloc((count - first) * sizeof(const char *));
+    procs = (void **) malloc((count - first) * sizeof(void *));
+    if (names == NULL || procs == NULL) {
+        free(names);
+        free(procs);
+        return GL_FALSE;
+    }
+    for (i=first; i<count; i++) {
+        names[i - first] = _glapi_get_proc_name(i);
+        assert(names[i - first] != NULL);
+    }
+
+    success = (*dispatch->getProcAddressList)(names, count - first,
+            procs, dispatch->getProcAddressParam);
+    free(names);
+
+    if (success) {
+        for (i=first; i<count; i++) {
+            void *procAddr = procs[i - first];
+            *_glapi_get_table_slot(dispatch->table, i) =
+                procAddr ? procAddr : (void *)noop_func;
+        }
+    }
+    free(procs);
+    return success;
+}
+
+/**
+ * Fills in a new dispatch table using the on-disk cache, if it's enabled.
+ *
+ * If there isn't a valid cache file, then this looks up each function
+ * normally, and then writes a new cache file.
+ *
+ * \return GL_TRUE if the entries up to \p count were filled in, or GL_FALSE
+ * if the caller should fill in the rest of the table. In either case,
+ * \c dispatch->stubsPopulated is updated.
+ */
+static GLboolean FixupDispatchTableFromCache(__GLdispatchTable *dispatch, int count)
+{
+    __GLdispatchCache *cache;
+    void **procs;
+    GLboolean missed = GL_FALSE;
+    int i;
+
+    CheckDispatchLocked();
+    assert(dispatch->stubsPopulated == 0);
+
+    if (!__glDispatchCacheIsEnabled()) {
+        return GL_FALSE;
+    }
+
+    // Look up functions until we find one that the vendor supports. That
+    // tells us which library the functions are in.
+    for (i=0; i<count; i++) {
+        void *procAddr = (*dispatch->getProcAddress)(
+                _glapi_get_proc_name(i), dispatch->getProcAddressParam);
+        dispatch->stubsPopulated = i + 1;
+        *_glapi_get_table_slot(dispatch->table, i) =
+            procAddr ? procAddr : (void *)noop_func;
+        if (procAddr != NULL) {
+            break;
+        }
+    }
+    ADD_STAT(slotsResolved, dispatch->stubsPopulated);
+    if (i >= count) {
+        return GL_TRUE;
+    }
+
+    cache = __glDispatchCacheOpen(i, *_glapi_get_table_slot(dispatch->table, i));
+    if (cache == NULL) {
+        return GL_FALSE;
+    }
+
+    for (i=dispatch->stubsPopulated; i<count; i++) {
+        const char *name = _glapi_get_proc_name(i);
+        void *procAddr;
+
+        if (__glDispatchCacheLookup(cache, i, name, &procAddr)) {
+            ADD_STAT(slotsFromCache, 1);
+        } else {
+            procAddr = (*dispatch->getProcAddress)(name,
+                    dispatch->getProcAddressParam);
+            ADD_STAT(slotsResolved, 1);
+            missed = GL_TRUE;
+        }
+        *_glapi_get_table_slot(dispatch->table, i) =
+            procAddr ? procAddr : (void *)noop_func;
+    }
+    dispatch->stubsPopulated = count;
+
+    if (missed) {
+        // The cache wants a flat array, which a sparse table isn't.
+        procs = (void **) malloc(count * sizeof(void *));
+        if (procs != NULL) {
+            for (i=0; i<count; i++) {
+                procs[i] = *_glapi_get_table_slot(dispatch->table, i);
+            }
+            __glDispatchCacheWrite(cache, procs, count, (const void *) noop_func);
+            free(procs);
+        }
+    }
+    __glDispatchCacheClose(cache);
+    return GL_TRUE;
+}
+
+static GLboolean FixupDerivedDispatchTable(__GLdispatchTable *dispatch);
+
+/**
+ * Fixes up \c dispatch->table, without touching the layer tables.
+ */
+static GLboolean FixupBaseDispatchTable(__GLdispatchTable *dispatch)
+{
+    DBG_PRINTF(20, "dispatch=%p\n", dispatch);
+    CheckDispatchLocked();
+
+    int count = _glapi_get_stub_count();
+    int i;
+
+    if (dispatch->parent != NULL) {
+        return FixupDerivedDispatchTable(dispatch);
     }
+
+    if (dispatch->table == NULL) {
+        // The slots that don't have a dispatch stub yet are left empty. If
+        // __glDispatchGetProcAddress generates a stub while this table is
+        // current, then it fills in the new slot.
+        dispatch->table = AllocDispatchTableMemory();
+        if (dispatch->table == NULL) {
+            return GL_FALSE;
+        }
+    }
+    if (!_glapi_reserve_table_slots(dispatch->table, count)) {
+        return GL_FALSE;
+    }
+
+    // If lazy resolving is enabled, then plug in the resolver stubs for as
+    // many slots as we can. Any slots that don't have a resolver stub get
+    // looked up normally.
+    if (lazyDispatch) {
+        for (; dispatch->stubsPopulated < count; dispatch->stubsPopulated++) {
+            _glapi_proc resolver = _glapi_get_lazy_resolver(dispatch->stubsPopulated);
+            if (resolver == NULL) {
+                break;
+            }
+            *_glapi_get_table_slot(dispatch->table, dispatch->stubsPopulated) =
+                (void *) resolver;
+        }
+    }
+
+    if (dispatch->stubsPopulated < count
+            && FixupDispatchTableFromList(dispatch, count)) {
+        ADD_STAT(slotsResolved, count - dispatch->stubsPopulated);
+        dispatch->stubsPopulated = count;
+        return GL_TRUE;
+    }
+
+    if (dispatch->stubsPopulated == 0 && count > 0
+            && FixupDispatchTableFromCache(dispatch, count)) {
+        return GL_TRUE;
+    }
+
+    for (i=dispatch->stubsPopulated; i<count; i++) {
+        const char *name = _glapi_get_proc_name(i);
+        void *procAddr;
+
+        assert(name != NULL);
+
+        procAddr = (void*)(*dispatch->getProcAddress)(
+            name, dispatch->getProcAddressParam);
+        *_glapi_get_table_slot(dispatch->table, i) =
+            procAddr ? procAddr : (void *)noop_func;
+    }
+    if (dispatch->stubsPopulated < count) {
+        ADD_STAT(slotsResolved, count - dispatch->stubsPopulated);
+    }
+    dispatch->stubsPopulated = count;
+
+    return GL_TRUE;
+}
+
+/**
+ * Fills in a layer's functions up to \p count.
+ */
+static void UpdateLayerProcs(__GLdispatchLayer *layer, int count)
+{
+    CheckDispatchLocked();
+
+    for (; layer->procsPopulated < count; layer->procsPopulated++) {
+        int slot = layer->procsPopulated;
+        const char *name = _glapi_get_proc_name(slot);
+        assert(name != NULL);
+        layer->procs[slot] = (*layer->getProcAddress)(name, slot, layer->param);
+    }
+}
+
+static void FreeLayerTables(__GLdispatchTable *dispatch)
+{
+    int i;
+    for (i=0; i<dispatch->numLayerTables; i++) {
+        FreeDispatchTableMemory(dispatch->layerTables[i]);
+    }
+    free(dispatch->layerTables);
+    dispatch->layerTables = NULL;
+    dispatch->numLayerTables = 0;
+}
+
+/**
+ * Fills in the layer tables for a dispatch table.
+ *
+ * If the set of layers hasn't changed, then this only updates the slots from
+ * \p first up to the current stub count. Otherwise, it rebuilds every layer
+ * table.
+ */
+static GLboolean FixupLayerTables(__GLdispatchTable *dispatch, int first)
+{
+    __GLdispatchLayer *layer;
+    int count = _glapi_get_stub_count();
+    struct _glapi_table *below;
+    int i;
+
+    CheckDispatchLocked();
+
+    if (dispatch->layerGeneration != layerGeneration) {
+        if (dispatch->numLayerTables != numLayers) {
+            // Layers can only be added or removed when no context is current,
+            // so nothing can be using the old tables.
+            assert(dispatch->currentThreads == 0);
+            FreeLayerTables(dispatch);
+
+            if (numLayers > 0) {
+                dispatch->layerTables = (struct _glapi_table **)
+                    calloc(numLayers, sizeof(struct _glapi_table *));
+                if (dispatch->layerTables == NULL) {
+                    return GL_FALSE;
+                }
+                for (i=0; i<numLayers; i++) {
+                    dispatch->layerTables[i] = AllocDispatchTableMemory();
+                    if (dispatch->layerTables[i] == NULL) {
+                        dispatch->numLayerTables = i;
+                        FreeLayerTables(dispatch);
+                        return GL_FALSE;
+                    }
+                }
+                dispatch->numLayerTables = numLayers;
+            }
+        }
+        dispatch->layerGeneration = layerGeneration;
+        first = 0;
+    }
+
+    below = dispatch->table;
+    glvnd_list_for_each_entry(layer, &layerList, entry) {
+        struct _glapi_table *tbl = dispatch->layerTables[layer->index];
+
+        if (!_glapi_reserve_table_slots(tbl, count)) {
+            return GL_FALSE;
+        }
+        UpdateLayerProcs(layer, _glapi_get_stub_count());
+        for (i=first; i<count; i++) {
+            if (i < layer->procsPopulated && layer->procs[i] != NULL) {
+                *_glapi_get_table_slot(tbl, i) = layer->procs[i];
+            } else {
+                *_glapi_get_table_slot(tbl, i) = *_glapi_get_table_slot(below, i);
+            }
+        }
+        below = tbl;
+    }
+
+    return GL_TRUE;
+}
+
+/*
+ * Fix up a dispatch table. Calls to this function must be protected by the
+ * dispatch lock.
+ */
+static GLboolean FixupDispatchTable(__GLdispatchTable *dispatch)
+{
+    int first = dispatch->stubsPopulated;
+
+    ADD_STAT(fixupCount, 1);
+
+    if (!FixupBaseDispatchTable(dispatch)) {
+        return GL_FALSE;
+    }
+    return FixupLayerTables(dispatch, first);
+}
+
+/**
+ * Returns the table to make current for \p dispatch. That's the outermost
+ * layer's table, or \c dispatch->table if there aren't any layers.
+ */
+static struct _glapi_table *GetLayeredTable(__GLdispatchTable *dispatch)
+{
+    if (dispatch->numLayerTables > 0) {
+        return dispatch->layerTables[dispatch->numLayerTables - 1];
+    }
+    return dispatch->table;
+}
+
+/**
+ * Fixes up a derived dispatch table.
+ *
+ * This fixes up the parent table first. If the derived table doesn't have any
+ * overrides, then it just uses the parent's table. Otherwise, it copies any
+ * new entries from the parent's table and then plugs in the overrides.
+ */
+static GLboolean FixupDerivedDispatchTable(__GLdispatchTable *dispatch)
+{
+    __GLdispatchTable *parent = dispatch->parent;
+    int count = _glapi_get_stub_count();
+    int first = dispatch->stubsPopulated;
+    int i;
+
+    CheckDispatchLocked();
+
+    if (!FixupBaseDispatchTable(parent)) {
+        return GL_FALSE;
+    }
+
+    if (dispatch->numOverrides == 0) {
+        dispatch->table = parent->table;
+        dispatch->stubsPopulated = count;
+        return GL_TRUE;
+    }
+
+    if (dispatch->table == NULL || dispatch->table == parent->table) {
+        struct _glapi_table *table = AllocDispatchTableMemory();
+        if (table == NULL) {
+            return GL_FALSE;
+        }
+        dispatch->table = table;
+        first = 0;
+    }
+    if (!_glapi_reserve_table_slots(dispatch->table, count)) {
+        return GL_FALSE;
+    }
+
+    for (i=first; i<count; i++) {
+        *_glapi_get_table_slot(dispatch->table, i) =
+            *_glapi_get_table_slot(parent->table, i);
+    }
+    dispatch->stubsPopulated = count;
+
+    for (i=0; i<dispatch->numOverrides; i++) {
+        *_glapi_get_table_slot(dispatch->table, dispatch->overrides[i].slot) =
+            dispatch->overrides[i].proc;
+    }
+
+    return GL_TRUE;
+}
+
+/**
+ * The resolve callback for the lazy resolver stubs. This looks up the real
+ * function for a slot in the current dispatch table and stores it in the
+ * table, so that later calls go straight to the vendor library.
+ */
+static _glapi_proc ResolveLazySlot(int slot)
+{
+    __GLdispatchThreadState *threadState;
+    __GLdispatchTable *dispatch;
+    const char *name;
+    void *procAddr = NULL;
+    void *resolver = (void *) _glapi_get_lazy_resolver(slot);
+    int i;
+
+    LockDispatch();
+
+    // The resolver stubs are only ever stored in a vendor's dispatch table,
+    // so if we got here, then that table must be current.
+    threadState = __glDispatchGetCurrentThreadState();
+    assert(threadState != NULL && threadState->priv != NULL);
+    dispatch = threadState->priv->dispatch;
+    assert((const void *) GetLayeredTable(dispatch) == (const void *) _glapi_get_current());
+
+    name = _glapi_get_proc_name(slot);
+    assert(name != NULL);
+
+    if (dispatch->getProcAddressList == NULL
+            || !(*dispatch->getProcAddressList)(&name, 1, &procAddr,
+                dispatch->getProcAddressParam)) {
+        procAddr = (*dispatch->getProcAddress)(name,
+                dispatch->getProcAddressParam);
+    }
+    if (procAddr == NULL) {
+        procAddr = (void *) noop_func;
+    }
+
+    // Other threads may be calling through this table at the same time, but
+    // they'll see either the resolver stub or the real function, both of
+    // which work.
+    *((void * volatile *) _glapi_get_table_slot(dispatch->table, slot)) = procAddr;
+    ADD_STAT(slotsResolved, 1);
+
+    // A layer table only has the resolver stub if none of the layers below it
+    // replace the function, so it can use the vendor's function directly.
+    for (i=0; i<dispatch->numLayerTables; i++) {
+        void * volatile *entry = (void * volatile *)
+            _glapi_get_table_slot(dispatch->layerTables[i], slot);
+        if (*entry == resolver) {
+            *entry = procAddr;
+        }
+    }
+
+    UnlockDispatch();
+
+    return (_glapi_proc) procAddr;
+}
+
+PUBLIC __GLdispatchProc __glDispatchGetProcAddress(const char *procName)
+{
+    int prevCount, count;
+    _glapi_proc addr;
+
+    /*
+     * We need to lock the dispatch before calling into glapi in order to
+     * prevent races when retrieving the entrypoint stub.
+     */
+    LockDispatch();
+    prevCount = _glapi_get_stub_count();
+    addr = _glapi_get_proc_address(procName);
+    /*
+     * If we generated a new stub, then any current dispatch tables need to be
+     * able to handle the new slot.
+     *
+     * Normally, we just plug in a resolver stub for the new slot, which looks
+     * up the function on the first call. FixupDispatchTable fills in the slot
+     * the next time the table is made current.
+     */
+    count = _glapi_get_stub_count();
+    if (count > prevCount) {
+        __GLdispatchTable *curDispatch;
+
+        ADD_STAT(stubsGenerated, count - prevCount);
+
+        if (_glapi_get_lazy_resolver(count - 1) != NULL && numLayers == 0) {
+            glvnd_list_for_each_entry(curDispatch, &dispatchTableList, entry) {
+                int slot;
+
+                if (curDispatch->currentThreads == 0) {
+                    continue;
+                }
+                assert(curDispatch->table != NULL);
+                // If we can't allocate the dynamic slots for a sparse table,
+                // then the new slot just goes to a no-op function until
+                // FixupDispatchTable tries again.
+                if (!_glapi_reserve_table_slots(curDispatch->table, count)) {
+                    continue;
+                }
+                for (slot = prevCount; slot < count; slot++) {
+                    *_glapi_get_table_slot(curDispatch->table, slot) =
+                        (void *) _glapi_get_lazy_resolver(slot);
+                }
+            }
+        } else {
+            /*
+             * We don't have a resolver stub, so fixup any current dispatch
+             * tables to contain the right pointer to this proc. We also have
+             * to do this if there are any layers, since a resolver stub would
+             * skip them.
+             */
+            glvnd_list_for_each_entry(curDispatch, &dispatchTableList, entry) {
+                if (curDispatch->currentThreads == 0) {
+                    continue;
+                }
+                // Sanity check: Every current dispatch table must have already
+                // been allocated. That's important because it means
+                // FixupDispatchTable can only fail if it runs out of memory
+                // for the dynamic slots of a sparse table.
+                assert(curDispatch->table != NULL);
+                FixupDispatchTable(curDispatch);
+            }
+        }
+    }
+    UnlockDispatch();
+
+    return addr;
+}
+
+PUBLIC __GLdispatchTable *__glDispatchCreateTable(
+        __GLgetProcAddressCallback getProcAddress, void *param)
+{
+    return __glDispatchCreateTableWithList(getProcAddress, NULL, param);
+}
+
+PUBLIC __GLdispatchTable *__glDispatchCreateTableWithList(
+        __GLgetProcAddressCallback getProcAddress,
+        __GLgetProcAddressListCallback getProcAddressList,
+        void *param)
+{
+    __GLdispatchTable *dispatch = calloc(1, sizeof(__GLdispatchTable));
+    if (dispatch == NULL) {
+        return NULL;
+    }
+
+    dispatch->getProcAddress = getProcAddress;
+    dispatch->getProcAddressList = getProcAddressList;
+    dispatch->getProcAddressParam = param;
+
+    LockDispatch();
+    glvnd_list_add(&dispatch->entry, &dispatchTableList);
+    UnlockDispatch();
+
+    return dispatch;
+}
+
+PUBLIC __GLdispatchTable *__glDispatchCreateDerivedTable(
+        __GLdispatchTable *parent)
+{
+    __GLdispatchTable *dispatch = calloc(1, sizeof(__GLdispatchTable));
+    if (dispatch == NULL) {
+        return NULL;
+    }
+
+    // The derived table still needs the vendor's callbacks, since the lazy
+    // resolver stubs look up functions using the current table.
+    dispatch->getProcAddress = parent->getProcAddress;
+    dispatch->getProcAddressList = parent->getProcAddressList;
+    dispatch->getProcAddressParam = parent->getProcAddressParam;
+    dispatch->parent = parent;
+
+    LockDispatch();
+    glvnd_list_add(&dispatch->entry, &dispatchTableList);
+    UnlockDispatch();
+
+    return dispatch;
+}
+
+PUBLIC GLboolean __glDispatchSetTableOverride(__GLdispatchTable *dispatch,
+        const char *procName, __GLdispatchProc proc)
+{
+    void *procAddr = (proc != NULL ? (void *) proc : (void *) noop_func);
+    int slot;
+    int i;
+
+    if (dispatch->parent == NULL) {
+        return GL_FALSE;
+    }
+
+    // Make sure that the function has a dispatch stub, and therefore a slot
+    // in the dispatch table.
+    if (__glDispatchGetProcAddress(procName) == NULL) {
+        return GL_FALSE;
+    }
+
+    LockDispatch();
+
+    slot = _glapi_get_proc_offset(procName);
+    assert(slot >= 0);
+
+    for (i=0; i<dispatch->numOverrides; i++) {
+        if (dispatch->overrides[i].slot == slot) {
+            break;
+        }
+    }
+    if (i == dispatch->numOverrides) {
+        __GLdispatchTableOverride *overrides = (__GLdispatchTableOverride *)
+            realloc(dispatch->overrides, (dispatch->numOverrides + 1)
+                    * sizeof(__GLdispatchTableOverride));
+        if (overrides == NULL) {
+            UnlockDispatch();
+            return GL_FALSE;
+        }
+        dispatch->overrides = overrides;
+        dispatch->overrides[i].slot = slot;
+        dispatch->numOverrides++;
+    }
+    dispatch->overrides[i].proc = procAddr;
+
+    // If the table already has its own copy, then update it now. Otherwise,
+    // FixupDerivedDispatchTable will make a copy the next time it's made
+    // current.
+    if (dispatch->table != NULL && dispatch->table != dispatch->parent->table
+            && _glapi_reserve_table_slots(dispatch->table, slot + 1)) {
+        *((void * volatile *) _glapi_get_table_slot(dispatch->table, slot)) = procAddr;
+    }
+
+    // Any layer tables copied the old function, so rebuild them, too.
+    dispatch->layerGeneration = -1;
+
+    // Likewise for any entrypoints that jump straight to the old function.
+    // The next __glDispatchMakeCurrent call will redirect them again.
+    if (dispatch == firstCurrentDispatch) {
+        StopDirectDispatch();
+    }
+
+    UnlockDispatch();
+    return GL_TRUE;
+}
+
+PUBLIC void __glDispatchDestroyTable(__GLdispatchTable *dispatch)
+{
+    /*
+     * XXX: Technically, dispatch->currentThreads should be 0 if we're calling
+     * into this function, but buggy apps may unload libGLX without losing
+     * current, in which case this won't be true when the dispatch table
+     * is destroyed.
+     */
+    LockDispatch();
+    if (firstCurrentDispatch != NULL && (dispatch == firstCurrentDispatch
+                || dispatch == firstCurrentDispatch->parent)) {
+        // The vendor library might be about to be unloaded, and a new table
+        // could end up at the same address, so don't use direct dispatch
+        // anymore.
+        StopDirectDispatch();
+        firstCurrentDispatch = NULL;
+        multipleCurrentDispatch = GL_TRUE;
+    }
+    if (dispatch->parent == NULL || dispatch->table != dispatch->parent->table) {
+        FreeDispatchTableMemory(dispatch->table);
+    }
+    glvnd_list_del(&dispatch->entry);
+    free(dispatch->overrides);
+    FreeLayerTables(dispatch);
+    free(dispatch);
+    UnlockDispatch();
+}
+
+static void RenumberLayers(void)
+{
+    __GLdispatchLayer *layer;
+    int index = 0;
+
+    CheckDispatchLocked();
+
+    glvnd_list_for_each_entry(layer, &layerList, entry) {
+        layer->index = index++;
+    }
+    numLayers = index;
+    layerGeneration++;
+}
+
+static __GLdispatchLayer *AddLayer(__GLdispatchLayerGetProcCallback getProcAddress,
+        void *param)
+{
+    __GLdispatchLayer *layer;
+
+    CheckDispatchLocked();
+
+    layer = (__GLdispatchLayer *) calloc(1, sizeof(__GLdispatchLayer));
+    if (layer == NULL) {
+        return NULL;
+    }
+    layer->procs = (void **) calloc(_glapi_get_dispatch_table_size(), sizeof(void *));
+    if (layer->procs == NULL) {
+        free(layer);
+        return NULL;
+    }
+    layer->getProcAddress = getProcAddress;
+    layer->param = param;
+
+    glvnd_list_append(&layer->entry, &layerList);
+    RenumberLayers();
+
+    return layer;
+}
+
+PUBLIC __GLdispatchLayer *__glDispatchRegisterLayer(
+        __GLdispatchLayerGetProcCallback getProcAddress, void *param)
+{
+    __GLdispatchLayer *layer = NULL;
+
+    LockDispatch();
+    if (numCurrentContexts == 0) {
+        layer = AddLayer(getProcAddress, param);
+        if (layer != NULL) {
+            // Direct dispatch would skip the layer.
+            StopDirectDispatch();
+        }
+    }
+    UnlockDispatch();
+
+    return layer;
+}
+
+PUBLIC GLboolean __glDispatchUnregisterLayer(__GLdispatchLayer *layer)
+{
+    LockDispatch();
+
+    if (numCurrentContexts > 0 || layer == countLayer) {
+        UnlockDispatch();
+        return GL_FALSE;
+    }
+
+    glvnd_list_del(&layer->entry);
+    RenumberLayers();
+    free(layer->procs);
+    free(layer);
+
+    UnlockDispatch();
+    return GL_TRUE;
+}
+
+PUBLIC const __GLdispatchProc *__glDispatchGetLayerNextTable(
+        const __GLdispatchLayer *layer)
+{
+    __GLdispatchThreadState *threadState = __glDispatchGetCurrentThreadState();
+    __GLdispatchTable *dispatch;
+
+    // The layers can't change while a context is current, so this doesn't
+    // need the dispatch lock.
+    if (threadState == NULL) {
+        return NULL;
+    }
+    dispatch = threadState->priv->dispatch;
+
+    assert(layer->index < dispatch->numLayerTables);
+    if (layer->index > 0) {
+        return (const __GLdispatchProc *) dispatch->layerTables[layer->index - 1];
+    } else {
+        return (const __GLdispatchProc *) dispatch->table;
+    }
+}
+
+PUBLIC __GLdispatchProc __glDispatchGetLayerNextProc(
+        const __GLdispatchLayer *layer, int slot)
+{
+    struct _glapi_table *next = (struct _glapi_table *)
+        __glDispatchGetLayerNextTable(layer);
+
+    if (next == NULL) {
+        return NULL;
+    }
+    return (__GLdispatchProc) *_glapi_get_table_slot(next, slot);
+}
+
+static GLboolean CallCountingIsEnabledByEnvVar(void)
+{
+    const char *str = getenv("__GLVND_COUNT_CALLS");
+    return (str != NULL && atoi(str) != 0);
+}
+
+static void *CountLayerGetProc(const char *procName, int slot, void *param)
+{
+    return (void *) _glapi_get_count_thunk(slot);
 }
 
-static void DispatchCurrentUnref(__GLdispatchTable *dispatch)
+/**
+ * The callback for the call counting stubs. This bumps the current thread's
+ * count for the slot, and returns the function from the next table down.
+ */
+static _glapi_proc CountSlot(int slot)
 {
-    CheckDispatchLocked();
-    dispatch->currentThreads--;
-    if (dispatch->currentThreads == 0) {
-        glvnd_list_del(&dispatch->entry);
+    __GLdispatchCallCounts *counts = (__GLdispatchCallCounts *)
+        __glvndPthreadFuncs.getspecific(threadCallCountsKey);
+
+    if (counts == NULL) {
+        counts = (__GLdispatchCallCounts *) calloc(1, sizeof(__GLdispatchCallCounts)
+                + _glapi_get_dispatch_table_size() * sizeof(GLuint64));
+        if (counts != NULL) {
+            LockDispatch();
+            glvnd_list_append(&counts->entry, &callCountsList);
+            UnlockDispatch();
+            __glvndPthreadFuncs.setspecific(threadCallCountsKey, counts);
+        }
     }
-    assert(dispatch->currentThreads >= 0);
+    if (counts != NULL) {
+        counts->counts[slot]++;
+    }
+
+    return (_glapi_proc) __glDispatchGetLayerNextProc(countLayer, slot);
 }
 
-/*
- * Fix up a dispatch table. Calls to this function must be protected by the
- * dispatch lock.
- */
-static GLboolean FixupDispatchTable(__GLdispatchTable *dispatch)
+static void ThreadCallCountsDestroyed(void *data)
 {
-    DBG_PRINTF(20, "dispatch=%p\n", dispatch);
-    CheckDispatchLocked();
-
-    void **tbl;
-    int count = _glapi_get_stub_count();
+    __GLdispatchCallCounts *counts = (__GLdispatchCallCounts *) data;
+    int size = _glapi_get_dispatch_table_size();
     int i;
 
-    if (dispatch->table == NULL) {
-        dispatch->table = (struct _glapi_table *)
-            calloc(1, _glapi_get_dispatch_table_size() * sizeof(void *));
-        if (dispatch->table == NULL) {
-            return GL_FALSE;
-        }
+    LockDispatch();
+    for (i=0; i<size; i++) {
+        retiredCallCounts[i] += counts->counts[i];
     }
+    glvnd_list_del(&counts->entry);
+    UnlockDispatch();
 
-    tbl = (void **)dispatch->table;
-    for (i=dispatch->stubsPopulated; i<count; i++) {
-        const char *name = _glapi_get_proc_name(i);
-        void *procAddr;
+    free(counts);
+}
 
-        assert(name != NULL);
+static GLuint64 SumCallCounts(int slot)
+{
+    __GLdispatchCallCounts *counts;
+    GLuint64 sum = retiredCallCounts[slot];
 
-        procAddr = (void*)(*dispatch->getProcAddress)(
-            name, dispatch->getProcAddressParam);
-        tbl[i] = procAddr ? procAddr : (void *)noop_func;
-    }
-    dispatch->stubsPopulated = count;
+    CheckDispatchLocked();
 
-    return GL_TRUE;
+    glvnd_list_for_each_entry(counts, &callCountsList, entry) {
+        sum += counts->counts[slot];
+    }
+    return sum;
 }
 
-PUBLIC __GLdispatchProc __glDispatchGetProcAddress(const char *procName)
+PUBLIC int __glDispatchGetCallCounts(const char **names, GLuint64 *counts,
+        int maxCount)
 {
-    int prevCount;
-    _glapi_proc addr;
+    int count;
+    int i;
 
-    /*
-     * We need to lock the dispatch before calling into glapi in order to
-     * prevent races when retrieving the entrypoint stub.
-     */
     LockDispatch();
-    prevCount = _glapi_get_stub_count();
-    addr = _glapi_get_proc_address(procName);
-    if (addr != NULL && prevCount != _glapi_get_stub_count()) {
-        __GLdispatchTable *curDispatch;
 
-        /*
-         * Fixup any current dispatch tables to contain the right pointer
-         * to this proc.
-         */
-        glvnd_list_for_each_entry(curDispatch, &currentDispatchList, entry) {
-            // Sanity check: Every current dispatch table must have already
-            // been allocated. That's important because it means
-            // FixupDispatchTable can't fail.
-            assert(curDispatch->table != NULL);
-            FixupDispatchTable(curDispatch);
+    if (countLayer == NULL) {
+        UnlockDispatch();
+        return 0;
+    }
+
+    count = _glapi_get_stub_count();
+    for (i=0; i<count && i<maxCount; i++) {
+        if (names != NULL) {
+            names[i] = _glapi_get_proc_name(i);
+        }
+        if (counts != NULL) {
+            counts[i] = SumCallCounts(i);
         }
     }
-    UnlockDispatch();
 
-    return addr;
+    UnlockDispatch();
+    return count;
 }
 
-PUBLIC __GLdispatchTable *__glDispatchCreateTable(
-        __GLgetProcAddressCallback getProcAddress, void *param)
+/**
+ * Writes the call counts to the file named by __GLVND_COUNT_CALLS_FILE, if
+ * it's set, and then frees everything used for call counting.
+ */
+static void CleanupCallCounts(void)
 {
-    __GLdispatchTable *dispatch = calloc(1, sizeof(__GLdispatchTable));
-    if (dispatch == NULL) {
-        return NULL;
+    __GLdispatchCallCounts *counts, *tmp;
+    const char *filename;
+
+    CheckDispatchLocked();
+
+    if (countLayer == NULL) {
+        return;
     }
 
-    dispatch->getProcAddress = getProcAddress;
-    dispatch->getProcAddressParam = param;
+    filename = getenv("__GLVND_COUNT_CALLS_FILE");
+    if (filename != NULL) {
+        FILE *out = fopen(filename, "w");
+        if (out != NULL) {
+            int count = _glapi_get_stub_count();
+            int i;
+            for (i=0; i<count; i++) {
+                GLuint64 sum = SumCallCounts(i);
+                if (sum != 0) {
+                    fprintf(out, "%llu %s\n", (unsigned long long) sum,
+                            _glapi_get_proc_name(i));
+                }
+            }
+            fclose(out);
+        }
+    }
 
-    return dispatch;
-}
+    glvnd_list_for_each_entry_safe(counts, tmp, &callCountsList, entry) {
+        glvnd_list_del(&counts->entry);
+        free(counts);
+    }
+    __glvndPthreadFuncs.key_delete(threadCallCountsKey);
+    free(retiredCallCounts);
+    retiredCallCounts = NULL;
+    _glapi_set_count_callback(NULL);
 
-PUBLIC void __glDispatchDestroyTable(__GLdispatchTable *dispatch)
-{
-    /*
-     * XXX: Technically, dispatch->currentThreads should be 0 if we're calling
-     * into this function, but buggy apps may unload libGLX without losing
-     * current, in which case this won't be true when the dispatch table
-     * is destroyed.
-     */
-    LockDispatch();
-    free(dispatch->table);
-    free(dispatch);
-    UnlockDispatch();
+    // The layer itself gets freed along with any other layers.
+    countLayer = NULL;
 }
 
 static int CurrentEntrypointsSafeToUse(int vendorID)
@@ -365,6 +1615,128 @@ static inline int ContextIsCurrentInAnyOtherThread(void)
     return !!otherContexts;
 }
 
+static inline int LivePatchingIsDisabledByEnvVar(void)
+{
+    static GLboolean inited = GL_FALSE;
+    static GLboolean disallowPatch = GL_FALSE;
+
+    CheckDispatchLocked();
+
+    if (!inited) {
+        char *disallowPatchStr = getenv("__GLVND_DISALLOW_LIVE_PATCHING");
+        if (disallowPatchStr) {
+            disallowPatch = atoi(disallowPatchStr);
+        }
+        inited = GL_TRUE;
+    }
+
+    return disallowPatch;
+}
+
+static __GLdispatchVendorContexts *FindVendorContexts(int vendorID)
+{
+    __GLdispatchVendorContexts *vendor;
+
+    CheckDispatchLocked();
+
+    glvnd_list_for_each_entry(vendor, &currentVendorList, entry) {
+        if (vendor->vendorID == vendorID) {
+            return vendor;
+        }
+    }
+    return NULL;
+}
+
+static __GLdispatchVendorContexts *CreateVendorContexts(int vendorID)
+{
+    __GLdispatchVendorContexts *vendor;
+
+    CheckDispatchLocked();
+
+    vendor = malloc(sizeof(*vendor));
+    if (vendor == NULL) {
+        return NULL;
+    }
+    vendor->vendorID = vendorID;
+    vendor->count = 0;
+    glvnd_list_add(&vendor->entry, &currentVendorList);
+    return vendor;
+}
+
+static GLboolean AddVendorContext(int vendorID)
+{
+    __GLdispatchVendorContexts *vendor = FindVendorContexts(vendorID);
+
+    if (vendor == NULL) {
+        vendor = CreateVendorContexts(vendorID);
+        if (vendor == NULL) {
+            return GL_FALSE;
+        }
+    }
+    vendor->count++;
+    return GL_TRUE;
+}
+
+static void RemoveVendorContext(int vendorID)
+{
+    __GLdispatchVendorContexts *vendor = FindVendorContexts(vendorID);
+
+    if (vendor != NULL) {
+        vendor->count--;
+        assert(vendor->count >= 0);
+    }
+}
+
+static void CleanupVendorContexts(void)
+{
+    __GLdispatchVendorContexts *vendor, *tmp;
+
+    glvnd_list_for_each_entry_safe(vendor, tmp, &currentVendorList, entry) {
+        glvnd_list_del(&vendor->entry);
+        free(vendor);
+    }
+}
+
+/**
+ * Returns true if we can patch the entrypoints while other threads are
+ * running them.
+ *
+ * The vendor has to opt in, since the other threads won't go through its
+ * threadAttach callback first. The patched entrypoints skip the dispatch
+ * table, so this only works if every other current context belongs to the
+ * same vendor. It also only works if the entrypoints aren't patched yet,
+ * since another thread could be running any of the current patched functions.
+ */
+static int LivePatchingIsSafe(const __GLdispatchPatchCallbacks *patchCb,
+        int vendorID)
+{
+    const __GLdispatchVendorContexts *vendor;
+
+    CheckDispatchLocked();
+
+    if (patchCb == NULL || stubCurrentPatchCb != NULL) {
+        return 0;
+    }
+
+    if (patchCb->isLivePatchSupported == NULL
+            || !patchCb->isLivePatchSupported()) {
+        return 0;
+    }
+
+    if (glvnd_list_is_empty(&dispatchStubList)) {
+        return 0;
+    }
+
+    if (PatchingIsDisabledByEnvVar() || LivePatchingIsDisabledByEnvVar()) {
+        return 0;
+    }
+
+    // This is only called from __glDispatchMakeCurrent, so the current
+    // thread doesn't have a current context yet.
+    vendor = FindVendorContexts(vendorID);
+    return (vendor != NULL && vendor->count == numCurrentContexts);
+}
+
 static int PatchingIsSafe(void)
 {
     CheckDispatchLocked();
@@ -481,10 +1853,16 @@ static int PatchEntrypoints(
 )
 {
     __GLdispatchStubCallback *stub;
+    GLboolean live = GL_FALSE;
     CheckDispatchLocked();
 
     if (!force && !PatchingIsSafe()) {
-        return 0;
+        // Other threads are running the entrypoints, so try to patch them
+        // without disturbing those threads.
+        if (!LivePatchingIsSafe(patchCb, vendorID)) {
+            return 0;
+        }
+        live = GL_TRUE;
     }
 
     if (patchCb == stubCurrentPatchCb) {
@@ -501,9 +1879,15 @@ static int PatchEntrypoints(
             stubCurrentPatchCb->releasePatch();
         }
 
-        // Restore the stubs to the default implementation.
+        // Restore the stubs to the default implementation. If the new vendor
+        // can patch a set of stubs, then leave them alone instead: The new
+        // vendor will overwrite most of the same functions, and finishPatch
+        // or abortPatch will restore whatever is left.
+        ADD_STAT(patchRestores, 1);
         glvnd_list_for_each_entry(stub, &dispatchStubList, entry) {
-            if (stub->isPatched) {
+            if (stub->isPatched && !(patchCb != NULL
+                        && patchCb->isPatchSupported(stub->callbacks.getStubType(),
+                            stub->callbacks.getStubSize()))) {
                 stub->callbacks.restoreFuncs();
                 stub->isPatched = GL_FALSE;
             }
@@ -516,11 +1900,20 @@ static int PatchEntrypoints(
     if (patchCb) {
         GLboolean anySuccess = GL_FALSE;
 
+        ADD_STAT(patchAttempts, 1);
+
         glvnd_list_for_each_entry(stub, &dispatchStubList, entry) {
             if (patchCb->isPatchSupported(stub->callbacks.getStubType(),
                         stub->callbacks.getStubSize()))
             {
-                if (stub->callbacks.startPatch()) {
+                GLboolean started;
+                if (live) {
+                    started = (stub->callbacks.startPatchLive != NULL
+                            && stub->callbacks.startPatchLive());
+                } else {
+                    started = stub->callbacks.startPatch();
+                }
+                if (started) {
                     if (patchCb->initiatePatch(stub->callbacks.getStubType(),
                                 stub->callbacks.getStubSize(),
                                 stub->callbacks.getPatchOffset)) {
@@ -531,6 +1924,11 @@ static int PatchEntrypoints(
                         stub->callbacks.abortPatch();
                         stub->isPatched = GL_FALSE;
                     }
+                } else if (stub->isPatched) {
+                    // We couldn't start patching, so restore whatever the
+                    // previous vendor left behind.
+                    stub->callbacks.restoreFuncs();
+                    stub->isPatched = GL_FALSE;
                 }
             } else if (stub->isPatched) {
                 // The vendor library can't patch these stubs, but they were
@@ -541,6 +1939,10 @@ static int PatchEntrypoints(
         }
 
         if (anySuccess) {
+            ADD_STAT(patchSuccesses, 1);
+            if (live) {
+                ADD_STAT(patchLiveSuccesses, 1);
+            }
             stubCurrentPatchCb = patchCb;
             stubOwnerVendorID = vendorID;
         } else {
@@ -552,6 +1954,104 @@ static int PatchEntrypoints(
     return 1;
 }
 
+/**
+ * Restores any entrypoints that UpdateDirectDispatch redirected.
+ *
+ * The entrypoints are only ever redirected with a single atomic store, so
+ * this is safe even if other threads are calling them.
+ */
+static void StopDirectDispatch(void)
+{
+    __GLdispatchStubCallback *stub;
+
+    CheckDispatchLocked();
+
+    if (directDispatchActive) {
+        glvnd_list_for_each_entry(stub, &dispatchStubList, entry) {
+            if (stub->isPatched) {
+                stub->callbacks.restoreFuncs();
+                stub->isPatched = GL_FALSE;
+            }
+        }
+        directDispatchActive = GL_FALSE;
+    }
+    directDispatchGeneration = -1;
+}
+
+/**
+ * Called from __glDispatchMakeCurrent after \p dispatch is fixed up.
+ *
+ * If \p dispatch is the only table that has ever been current, then this
+ * redirects the entrypoints to jump straight to its functions, which skips
+ * looking up the current table on every call. Otherwise, it restores them.
+ *
+ * The redirected entrypoints don't go to the no-op table when there's no
+ * current context, so this is only done while there's a single thread, and
+ * LoseCurrentInternal stops it when the last context is released.
+ *
+ * Vendor patching takes priority over this, since a vendor that provides its
+ * own entrypoints can probably do better than a jump to its functions.
+ */
+static void UpdateDirectDispatch(__GLdispatchTable *dispatch, int vendorID,
+        const __GLdispatchPatchCallbacks *patchCb)
+{
+    __GLdispatchStubCallback *stub;
+    GLboolean redirected = GL_FALSE;
+
+    CheckDispatchLocked();
+
+    if (firstCurrentDispatch == NULL) {
+        firstCurrentDispatch = dispatch;
+        firstCurrentVendorID = vendorID;
+    } else if (firstCurrentDispatch != dispatch) {
+        multipleCurrentDispatch = GL_TRUE;
+    }
+
+    // With lazy dispatch, the table is mostly resolver stubs, and jumping to
+    // those would mean that we never get to skip them.
+    if (!directDispatch || lazyDispatch || multipleCurrentDispatch
+            || isMultiThreaded || PatchingIsDisabledByEnvVar()
+            || numLayers > 0 || patchCb != NULL || stubCurrentPatchCb != NULL) {
+        StopDirectDispatch();
+        return;
+    }
+
+    // Only try again if a new set of stubs has been registered since the last
+    // time.
+    if (directDispatchGeneration == dispatchStubListGeneration) {
+        return;
+    }
+    directDispatchGeneration = dispatchStubListGeneration;
+
+    glvnd_list_for_each_entry(stub, &dispatchStubList, entry) {
+        if (!stub->isPatched && stub->callbacks.redirectFuncs != NULL
+                && stub->callbacks.redirectFuncs((const void * const *) dispatch->table)) {
+            stub->isPatched = GL_TRUE;
+            redirected = GL_TRUE;
+        }
+    }
+    if (redirected) {
+        directDispatchActive = GL_TRUE;
+        ADD_STAT(directDispatchCount, 1);
+    }
+}
+
+/**
+ * Frees a __GLdispatchThreadStatePrivate struct, or saves it for the next
+ * __glDispatchMakeCurrent call on the current thread.
+ *
+ * This must not be called from a thread destructor, since the spare struct
+ * might not get freed after that.
+ */
+static void ReleaseThreadStatePrivate(__GLdispatchThreadStatePrivate *priv)
+{
+    if (__glvndPthreadFuncs.getspecific(threadSparePrivKey) == NULL) {
+        __glvndPthreadFuncs.setspecific(threadSparePrivKey, priv);
+    } else {
+        free(priv);
+    }
+}
+
 PUBLIC GLboolean __glDispatchMakeCurrent(__GLdispatchThreadState *threadState,
                                          __GLdispatchTable *dispatch,
                                          int vendorID,
@@ -559,37 +2059,63 @@ PUBLIC GLboolean __glDispatchMakeCurrent(__GLdispatchThreadState *threadState,
 {
     __GLdispatchThreadStatePrivate *priv;
 
+    ADD_STAT(makeCurrentCount, 1);
+
     if (__glDispatchGetCurrentThreadState() != NULL) {
         assert(!"__glDispatchMakeCurrent called with a current API state\n");
         return GL_FALSE;
     }
 
-    priv = (__GLdispatchThreadStatePrivate *) malloc(sizeof(__GLdispatchThreadStatePrivate));
-    if (priv == NULL) {
-        return GL_FALSE;
+    priv = (__GLdispatchThreadStatePrivate *)
+        __glvndPthreadFuncs.getspecific(threadSparePrivKey);
+    if (priv != NULL) {
+        __glvndPthreadFuncs.setspecific(threadSparePrivKey, NULL);
+    } else {
+        priv = (__GLdispatchThreadStatePrivate *) malloc(sizeof(__GLdispatchThreadStatePrivate));
+        if (priv == NULL) {
+            return GL_FALSE;
+        }
     }
 
     // We need to fix up the dispatch table if it hasn't been
     // initialized, or there are new dynamic entries which were
     // added since the last time make current was called.
+    //
+    // Note that this still serializes every MakeCurrent and LoseCurrent call
+    // on the dispatch lock. Once the thread's private struct is allocated,
+    // though, the rest of this only updates counts.
     LockDispatch();
 
-    // Patch if necessary
-    PatchEntrypoints(patchCb, vendorID, GL_FALSE);
+    // Patch if necessary. Patched entrypoints would skip any layers, so if
+    // there are any, then restore the default entrypoints instead. A vendor
+    // patch also has to start from the default entrypoints, so stop using
+    // direct dispatch first.
+    if (patchCb != NULL) {
+        StopDirectDispatch();
+    }
+    PatchEntrypoints(numLayers > 0 ? NULL : patchCb, vendorID, GL_FALSE);
 
     // If the current entrypoints are unsafe to use with this vendor, bail out.
     if (!CurrentEntrypointsSafeToUse(vendorID)) {
         UnlockDispatch();
-        free(priv);
+        ReleaseThreadStatePrivate(priv);
         return GL_FALSE;
     }
 
     if (!FixupDispatchTable(dispatch)) {
         UnlockDispatch();
-        free(priv);
+        ReleaseThreadStatePrivate(priv);
+        return GL_FALSE;
+    }
+
+    if (!AddVendorContext(vendorID)) {
+        UnlockDispatch();
+        ReleaseThreadStatePrivate(priv);
         return GL_FALSE;
     }
 
+    UpdateDirectDispatch(dispatch, vendorID, patchCb);
+
     DispatchCurrentRef(dispatch);
     numCurrentContexts++;
 
@@ -607,7 +2133,7 @@ PUBLIC GLboolean __glDispatchMakeCurrent(__GLdispatchThreadState *threadState,
      * Set the current state in TLS.
      */
     SetCurrentThreadState(threadState);
-    _glapi_set_current(dispatch->table);
+    _glapi_set_current(GetLayeredTable(dispatch));
 
     return GL_TRUE;
 }
@@ -623,12 +2149,22 @@ static void LoseCurrentInternal(__GLdispatchThreadState *curThreadState,
 
     if (curThreadState) {
         numCurrentContexts--;
+        if (numCurrentContexts == 0) {
+            // Without a current context, calls have to go to the no-op table
+            // instead of the redirected functions.
+            StopDirectDispatch();
+        }
         if (curThreadState->priv != NULL) {
+            RemoveVendorContext(curThreadState->priv->vendorID);
             if (curThreadState->priv->dispatch != NULL) {
                 DispatchCurrentUnref(curThreadState->priv->dispatch);
             }
 
-            free(curThreadState->priv);
+            if (threadDestroyed) {
+                free(curThreadState->priv);
+            } else {
+                ReleaseThreadStatePrivate(curThreadState->priv);
+            }
             curThreadState->priv = NULL;
         }
     }
@@ -643,6 +2179,8 @@ static void LoseCurrentInternal(__GLdispatchThreadState *curThreadState,
 PUBLIC void __glDispatchLoseCurrent(void)
 {
     __GLdispatchThreadState *curThreadState = __glDispatchGetCurrentThreadState();
+
+    ADD_STAT(loseCurrentCount, 1);
     if (curThreadState == NULL) {
         return;
     }
@@ -654,6 +2192,10 @@ PUBLIC GLboolean __glDispatchForceUnpatch(int vendorID)
     GLboolean ret = GL_FALSE;
 
     LockDispatch();
+    if (firstCurrentDispatch != NULL && firstCurrentVendorID == vendorID) {
+        // The entrypoints might jump straight into the vendor library.
+        StopDirectDispatch();
+    }
     if (stubCurrentPatchCb != NULL && stubOwnerVendorID == vendorID) {
         /*
          * The vendor library with the patch callbacks is about to be unloaded,
@@ -688,20 +2230,20 @@ void SetCurrentThreadState(__GLdispatchThreadState *threadState)
  */
 void __glDispatchReset(void)
 {
-    __GLdispatchTable *cur, *tmp;
+    __GLdispatchTable *cur;
 
     /* Reset the dispatch lock */
     __glvndPthreadFuncs.mutex_init(&dispatchLock.lock, NULL);
     dispatchLock.isLocked = 0;
+    __glvndPthreadFuncs.mutex_init(&threadStatsLock, NULL);
 
     LockDispatch();
     /*
-     * Clear out the current dispatch list.
+     * None of the tables are current in the child process.
      */
 
-    glvnd_list_for_each_entry_safe(cur, tmp, &currentDispatchList, entry) {
+    glvnd_list_for_each_entry(cur, &dispatchTableList, entry) {
         cur->currentThreads = 0;
-        glvnd_list_del(&cur->entry);
     }
     UnlockDispatch();
 
@@ -726,10 +2268,49 @@ void __glDispatchFini(void)
     clientRefcount--;
 
     if (clientRefcount == 0) {
+        __GLdispatchLayer *layer, *tmpLayer;
+
+        StopDirectDispatch();
+        firstCurrentDispatch = NULL;
+        multipleCurrentDispatch = GL_FALSE;
+
         /* This frees the dispatchStubList */
         UnregisterAllStubCallbacks();
 
+        CleanupCallCounts();
+        CleanupVendorContexts();
+
+        glvnd_list_for_each_entry_safe(layer, tmpLayer, &layerList, entry) {
+            glvnd_list_del(&layer->entry);
+            free(layer->procs);
+            free(layer);
+        }
+        RenumberLayers();
+        FreeTableArenas();
+
         __glvndPthreadFuncs.key_delete(threadContextKey);
+        __glvndPthreadFuncs.key_delete(threadAttachedKey);
+
+        // The key destructor won't run for the current thread, so free its
+        // spare private struct here.
+        free(__glvndPthreadFuncs.getspecific(threadSparePrivKey));
+        __glvndPthreadFuncs.key_delete(threadSparePrivKey);
+        _glapi_set_resolve_callback(NULL);
+
+        // Keep the counts from every thread, but free the per-thread structs.
+        if (threadStatsKeyCreated) {
+            __GLdispatchThreadStats *threadStats, *tmpStats;
+
+            threadStatsKeyCreated = 0;
+            __glvndPthreadFuncs.mutex_lock(&threadStatsLock);
+            glvnd_list_for_each_entry_safe(threadStats, tmpStats, &threadStatsList, entry) {
+                AccumulateStats(&retiredStats, &threadStats->stats);
+                glvnd_list_del(&threadStats->entry);
+                free(threadStats);
+            }
+            __glvndPthreadFuncs.mutex_unlock(&threadStatsLock);
+            __glvndPthreadFuncs.key_delete(threadStatsKey);
+        }
 
         // Clean up GLAPI thread state
         _glapi_destroy();
@@ -738,22 +2319,32 @@ void __glDispatchFini(void)
     UnlockDispatch();
 }
 
-void __glDispatchCheckMultithreaded(void)
+/*
+ * Handles the first call to __glDispatchCheckMultithreaded from a thread.
+ *
+ * This is the only part of the attach path that takes the dispatch lock, and
+ * once the process is known to be multithreaded, it doesn't need the lock at
+ * all.
+ */
+static void ThreadAttachFirstCall(void)
 {
-    if (!__glvndPthreadFuncs.is_singlethreaded)
-    {
-        // Check to see if the current thread has a dispatch table assigned to
-        // it, and if it doesn't, then plug in the no-op table.
-        // This is a partial workaround to broken applications that try to call
-        // OpenGL functions without a current context, without adding any
-        // additional overhead to the dispatch stubs themselves. As long as the
-        // thread calls at least one GLX function first, any OpenGL calls will
-        // go to the no-op stubs instead of crashing.
-        if (_glapi_get_current() == NULL) {
-            // Calling _glapi_set_current(NULL) will plug in the no-op table.
-            _glapi_set_current(NULL);
-        }
+    // Check to see if the current thread has a dispatch table assigned to
+    // it, and if it doesn't, then plug in the no-op table.
+    // This is a partial workaround to broken applications that try to call
+    // OpenGL functions without a current context, without adding any
+    // additional overhead to the dispatch stubs themselves. As long as the
+    // thread calls at least one GLX function first, any OpenGL calls will
+    // go to the no-op stubs instead of crashing.
+    //
+    // A thread's dispatch table can only go back to NULL if the GLAPI layer
+    // is torn down and re-initialized, and in that case threadAttachedKey is
+    // re-created as well, so we only need to do this once per thread.
+    if (_glapi_get_current() == NULL) {
+        // Calling _glapi_set_current(NULL) will plug in the no-op table.
+        _glapi_set_current(NULL);
+    }
 
+    if (!isMultiThreaded) {
         LockDispatch();
         if (!isMultiThreaded) {
             glvnd_thread_t tid = __glvndPthreadFuncs.self();
@@ -762,9 +2353,29 @@ void __glDispatchCheckMultithreaded(void)
             } else if (!__glvndPthreadFuncs.equal(firstThreadId, tid)) {
                 isMultiThreaded = 1;
                 _glapi_set_multithread();
+
+                // The new thread doesn't have a current context, so it
+                // can't use the redirected entrypoints.
+                StopDirectDispatch();
             }
         }
         UnlockDispatch();
+    }
+
+    __glvndPthreadFuncs.setspecific(threadAttachedKey, &threadAttachedKey);
+}
+
+void __glDispatchCheckMultithreaded(void)
+{
+    if (!__glvndPthreadFuncs.is_singlethreaded)
+    {
+        // Once a thread has been attached, there's nothing else to check for
+        // it: Either it's the first thread, in which case nothing changes
+        // until a different thread shows up, or isMultiThreaded is already
+        // set.
+        if (__glvndPthreadFuncs.getspecific(threadAttachedKey) == NULL) {
+            ThreadAttachFirstCall();
+        }
 
         if (stubCurrentPatchCb != NULL && stubCurrentPatchCb->threadAttach != NULL) {
             stubCurrentPatchCb->threadAttach();
@@ -58,7 +58,7 @@
  *
  * \see __glDispatchGetABIVersion
  */
-#define GLDISPATCH_ABI_VERSION 1
+#define GLDISPATCH_ABI_VERSION 3
 
 /* Namespaces for thread state */
 enum {
@@ -75,6 +75,24 @@ typedef void (*__GLdispatchProc)(void);
 
 typedef void *(*__GLgetProcAddressCallback)(const char *procName, void *param);
 
+/*!
+ * A callback to look up a whole list of functions with one call.
+ *
+ * libGLdispatch uses this to fill in a dispatch table, passing the names in
+ * the same order as the dispatch table slots.
+ *
+ * \param procNames The names of the functions to look up.
+ * \param count The number of elements in \p procNames and \p procs.
+ * \param[out] procs Receives the address of each function, or \c NULL for
+ *      each function that the vendor library doesn't support.
+ * \param param The pointer passed to \c __glDispatchCreateTableWithList.
+ * \return GL_TRUE on success. If this returns GL_FALSE, then libGLdispatch
+ *      will ignore the contents of \p procs and look up each function with
+ *      the \c __GLgetProcAddressCallback instead.
+ */
+typedef GLboolean (*__GLgetProcAddressListCallback)(const char * const *procNames,
+        int count, void **procs, void *param);
+
 /**
  * An opaque structure used for internal thread state data.
  */
@@ -210,6 +228,22 @@ typedef struct __GLdispatchPatchCallbacksRec {
      * \note This function may be called concurrently from multiple threads.
      */
     void (*threadAttach)(void);
+
+    /*!
+     * (OPTIONAL) Checks whether libGLdispatch may patch the entrypoints
+     * while other threads have one of this vendor's contexts current.
+     *
+     * Normally, libGLdispatch only patches the entrypoints when no other
+     * thread has a current context, so a thread always goes through
+     * \c threadAttach before it can reach the patched entrypoints. With live
+     * patching, a thread that's already current can start running the
+     * vendor's patched code in the middle of a frame, without calling
+     * \c threadAttach first. A vendor must only return GL_TRUE if its patched
+     * code can handle that.
+     *
+     * If this is \c NULL, then live patching is never used for this vendor.
+     */
+    GLboolean (*isLivePatchSupported)(void);
 } __GLdispatchPatchCallbacks;
 
 /*!
@@ -270,11 +304,210 @@ PUBLIC __GLdispatchTable *__glDispatchCreateTable(
     void *param
 );
 
+/*!
+ * Create a new dispatch table, using a callback that can look up every
+ * function in the table at once.
+ *
+ * This is the same as \c __glDispatchCreateTable, except that GLdispatch
+ * will try \p getProcAddressList first when it populates the table.
+ * \p getProcAddress is still required, and is used if \p getProcAddressList
+ * returns GL_FALSE.
+ *
+ * \param[in] getProcAddress a vendor library callback to look up a single
+ * function.
+ * \param[in] getProcAddressList a vendor library callback to look up a list
+ * of functions. This may be \c NULL.
+ * \param[in] param A pointer to pass to \p getProcAddress and
+ * \p getProcAddressList.
+ */
+PUBLIC __GLdispatchTable *__glDispatchCreateTableWithList(
+    __GLgetProcAddressCallback getProcAddress,
+    __GLgetProcAddressListCallback getProcAddressList,
+    void *param
+);
+
+/*!
+ * Create a dispatch table that's derived from another dispatch table.
+ *
+ * A derived table uses the same functions as \p parent, except for any
+ * functions that are replaced with \c __glDispatchSetTableOverride. This
+ * lets a vendor library use a different set of functions for some contexts
+ * without having to look up every function again.
+ *
+ * Until it has any overrides, a derived table shares the same function
+ * pointers as \p parent. The first override makes a private copy.
+ *
+ * \p parent must not be destroyed until all tables derived from it have been
+ * destroyed.
+ *
+ * \param[in] parent The dispatch table to derive from.
+ */
+PUBLIC __GLdispatchTable *__glDispatchCreateDerivedTable(
+    __GLdispatchTable *parent
+);
+
+/*!
+ * Replaces a function in a derived dispatch table.
+ *
+ * If \p proc is \c NULL, then the function is replaced with a no-op, as if
+ * the vendor library didn't support it.
+ *
+ * Overrides should be set before the table is first made current. If the
+ * table is already current, then the new function might not be used until
+ * the next time the table is made current.
+ *
+ * \param[in] dispatch A table created with \c __glDispatchCreateDerivedTable.
+ * \param[in] procName The name of the function to replace.
+ * \param[in] proc The new function.
+ * \return GL_TRUE on success, or GL_FALSE if \p dispatch isn't a derived
+ * table or if \p procName isn't a valid GL function name.
+ */
+PUBLIC GLboolean __glDispatchSetTableOverride(__GLdispatchTable *dispatch,
+        const char *procName, __GLdispatchProc proc);
+
 /*!
  * Destroy a dispatch table in GLdispatch.
  */
 PUBLIC void __glDispatchDestroyTable(__GLdispatchTable *dispatch);
 
+/*!
+ * An opaque handle for a dispatch layer.
+ */
+typedef struct __GLdispatchLayerRec __GLdispatchLayer;
+
+/*!
+ * A callback to look up a layer's replacement for a function.
+ *
+ * \param procName The name of the function.
+ * \param slot The index of the function in the table returned by
+ *      \c __glDispatchGetLayerNextTable.
+ * \param param The pointer passed to \c __glDispatchRegisterLayer.
+ * \return The layer's function, or \c NULL to pass calls straight through to
+ *      the next layer.
+ */
+typedef void *(*__GLdispatchLayerGetProcCallback)(const char *procName,
+        int slot, void *param);
+
+/*!
+ * Registers a dispatch layer.
+ *
+ * A layer sits between the application and the vendor library, and can
+ * replace any GL function with its own. This can be used for tracing,
+ * validation, and so on.
+ *
+ * Each new layer is added on top of any existing layers. A layer's functions
+ * call down to the next layer (or to the vendor library) using the table
+ * returned by \c __glDispatchGetLayerNextTable.
+ *
+ * Layers can only be registered or unregistered while no context is current
+ * on any thread. Entrypoint patching is disabled while any layer is
+ * registered, since patched entrypoints would skip the layers.
+ *
+ * \param[in] getProcAddress A callback to look up the layer's functions.
+ * \param[in] param A pointer to pass to \p getProcAddress.
+ * \return A handle for the layer, or \c NULL on failure.
+ */
+PUBLIC __GLdispatchLayer *__glDispatchRegisterLayer(
+        __GLdispatchLayerGetProcCallback getProcAddress, void *param);
+
+/*!
+ * Unregisters a dispatch layer.
+ *
+ * \return GL_TRUE on success, or GL_FALSE if a context is current.
+ */
+PUBLIC GLboolean __glDispatchUnregisterLayer(__GLdispatchLayer *layer);
+
+/*!
+ * Returns the table that \p layer should call into for the current context.
+ *
+ * The table is indexed by the slot numbers passed to the layer's
+ * \c __GLdispatchLayerGetProcCallback. If libGLdispatch is built with sparse
+ * dispatch tables, then only the static slots can be indexed directly, so
+ * layers should use \c __glDispatchGetLayerNextProc for any other function.
+ *
+ * \return The next table, or \c NULL if no context is current.
+ */
+PUBLIC const __GLdispatchProc *__glDispatchGetLayerNextTable(
+        const __GLdispatchLayer *layer);
+
+/*!
+ * Returns the function in \p slot of the table that \p layer should call
+ * into for the current context.
+ *
+ * Unlike indexing the table from \c __glDispatchGetLayerNextTable, this works
+ * for any slot, regardless of the table layout.
+ *
+ * \return The next function, or \c NULL if no context is current.
+ */
+PUBLIC __GLdispatchProc __glDispatchGetLayerNextProc(
+        const __GLdispatchLayer *layer, int slot);
+
+/*!
+ * Returns the number of times that each GL function has been called.
+ *
+ * Call counting is only enabled if the __GLVND_COUNT_CALLS environment
+ * variable is set to a non-zero value when GLdispatch is initialized. If
+ * __GLVND_COUNT_CALLS_FILE is also set, then the counts are written to that
+ * file when GLdispatch is unloaded.
+ *
+ * Each thread keeps its own counts, which are added up here. The counts only
+ * include calls made while a context was current.
+ *
+ * \param[out] names Receives the name of each function. This may be NULL.
+ * \param[out] counts Receives the call count for each function. This may be
+ *      NULL.
+ * \param[in] maxCount The number of elements in \p names and \p counts.
+ * \return The number of functions, which may be more than \p maxCount, or
+ *      zero if call counting isn't enabled.
+ */
+PUBLIC int __glDispatchGetCallCounts(const char **names, GLuint64 *counts,
+        int maxCount);
+
+/*!
+ * Counters for libGLdispatch's own overhead.
+ *
+ * Every member must be a GLuint64.
+ */
+typedef struct __GLdispatchStatsRec {
+    /*! Calls to __glDispatchMakeCurrent */
+    GLuint64 makeCurrentCount;
+    /*! Calls to __glDispatchLoseCurrent */
+    GLuint64 loseCurrentCount;
+    /*! Dispatch table fixups */
+    GLuint64 fixupCount;
+    /*! Dispatch table slots looked up */
+    GLuint64 slotsResolved;
+    /*! Dispatch table slots filled in from the on-disk cache */
+    GLuint64 slotsFromCache;
+    /*! Dynamic dispatch stubs generated */
+    GLuint64 stubsGenerated;
+    /*! Attempts to patch the entrypoints */
+    GLuint64 patchAttempts;
+    /*! Successful entrypoint patches */
+    GLuint64 patchSuccesses;
+    /*! Restores of the default entrypoints */
+    GLuint64 patchRestores;
+    /*! Successful entrypoint patches while other threads were current */
+    GLuint64 patchLiveSuccesses;
+    /*! Times the entrypoints were redirected straight to a vendor's functions */
+    GLuint64 directDispatchCount;
+    /*! Dispatch lock acquisitions */
+    GLuint64 lockCount;
+    /*! Acquisitions that had to wait */
+    GLuint64 lockContendedCount;
+    /*! Total time spent waiting for the dispatch lock, in nanoseconds */
+    GLuint64 lockContendedNanoseconds;
+} __GLdispatchStats;
+
+/*!
+ * Returns the current values of libGLdispatch's statistics counters.
+ *
+ * Each thread keeps its own counters, which are added up here, so keeping
+ * track of them doesn't need any extra locking. The counters from threads
+ * that have terminated are still included.
+ */
+PUBLIC void __glDispatchGetStats(__GLdispatchStats *stats);
+
 /*!
  * This makes the given thread state current, and assigns this thread state the
  * passed-in current dispatch table and vendor ID.
@@ -317,6 +550,10 @@ PUBLIC __GLdispatchThreadState *__glDispatchGetCurrentThreadState(void);
 /**
  * Checks to see if multiple threads are being used. This should be called
  * periodically from places like glXMakeCurrent.
+ *
+ * Only the first call from each thread takes the dispatch lock. After that,
+ * this function only checks a thread-specific flag, so it's cheap enough to
+ * call at the start of every GLX and EGL entrypoint.
  */
 PUBLIC void __glDispatchCheckMultithreaded(void);
 
@@ -0,0 +1,393 @@
+/*
+ * Copyright (c) 2013, NVIDIA CORPORATION.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and/or associated documentation files (the
+ * "Materials"), to deal in the Materials without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Materials, and to
+ * permit persons to whom the Materials are furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * unaltered in all copies or substantial portions of the Materials.
+ * Any additions, deletions, or changes to the original source files
+ * must be clearly indicated in accompanying documentation.
+ *
+ * If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the
+ * work of the Khronos Group."
+ *
+ * THE MATERIALS ARE PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * MATERIALS OR THE USE OR OTHER DEALINGS IN THE MATERIALS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "GLdispatchCache.h"
+#include "glapi.h"
+#include "trace.h"
+#include "utils_misc.h"
+
+#define CACHE_MAGIC "GLVNDDC1"
+
+/*!
+ * The offset stored for a function that the vendor library doesn't support.
+ */
+#define CACHE_NOT_PRESENT UINT64_MAX
+
+/*!
+ * The header at the start of a cache file.
+ *
+ * The header is followed by the library path, then by \c count
+ * CacheFileEntry structs, and then by the function names. Everything is in
+ * native byte order, since a cache file is only ever used on the machine that
+ * wrote it.
+ */
+typedef struct CacheFileHeaderRec {
+    char magic[8];
+    uint32_t pointerSize;
+    uint32_t count;
+
+    uint64_t libSize;
+    int64_t libMtime;
+    int64_t libMtimeNsec;
+
+    /// The slot and offset of the function passed to __glDispatchCacheOpen.
+    uint32_t sampleSlot;
+    uint32_t pathLength;
+    uint64_t sampleOffset;
+
+    /// The size of the function names at the end of the file.
+    uint64_t namesSize;
+} CacheFileHeader;
+
+typedef struct CacheFileEntryRec {
+    /// The offset of the function from the library's load address, or
+    /// CACHE_NOT_PRESENT.
+    uint64_t offset;
+
+    /// The offset of the function name within the names.
+    uint64_t nameOffset;
+} CacheFileEntry;
+
+struct __GLdispatchCacheRec {
+    char *libPath;
+    char *cachePath;
+    char *base;
+    CacheFileHeader key;
+
+    /// The mapped cache file, or NULL if there isn't a valid one.
+    void *mapping;
+    size_t mappingSize;
+    const CacheFileEntry *entries;
+    const char *names;
+};
+
+static const char *GetCacheDir(void)
+{
+    const char *dir = getenv("__GLVND_DISPATCH_CACHE_DIR");
+    if (dir != NULL && dir[0] == '\0') {
+        return NULL;
+    }
+    return dir;
+}
+
+int __glDispatchCacheIsEnabled(void)
+{
+    return (GetCacheDir() != NULL);
+}
+
+/*!
+ * Computes an FNV-1a hash. This is only used to pick a file name, since the
+ * cache file itself records the full key.
+ */
+static uint64_t HashKey(const CacheFileHeader *key, const char *path)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    const unsigned char *p;
+
+    for (p = (const unsigned char *) path; *p != '\0'; p++) {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    hash = (hash ^ key->sampleSlot) * 1099511628211ULL;
+    hash = (hash ^ key->sampleOffset) * 1099511628211ULL;
+    return hash;
+}
+
+/*!
+ * Maps the cache file and checks that it matches \c cache->key.
+ */
+static void MapCacheFile(__GLdispatchCache *cache)
+{
+    const CacheFileHeader *header;
+    const char *data;
+    struct stat st;
+    size_t entriesOffset;
+    size_t namesOffset;
+    int fd;
+    uint32_t i;
+
+    fd = open(cache->cachePath, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(CacheFileHeader)) {
+        close(fd);
+        return;
+    }
+    cache->mappingSize = st.st_size;
+    cache->mapping = mmap(NULL, cache->mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (cache->mapping == MAP_FAILED) {
+        cache->mapping = NULL;
+        return;
+    }
+
+    data = (const char *) cache->mapping;
+    header = (const CacheFileHeader *) data;
+
+    if (memcmp(header->magic, cache->key.magic, sizeof(header->magic)) != 0
+            || header->pointerSize != cache->key.pointerSize
+            || header->libSize != cache->key.libSize
+            || header->libMtime != cache->key.libMtime
+            || header->libMtimeNsec != cache->key.libMtimeNsec
+            || header->sampleSlot != cache->key.sampleSlot
+            || header->sampleOffset != cache->key.sampleOffset
+            || header->pathLength != cache->key.pathLength) {
+        goto fail;
+    }
+
+    entriesOffset = sizeof(CacheFileHeader) + header->pathLength;
+    namesOffset = entriesOffset + header->count * sizeof(CacheFileEntry);
+    if (namesOffset > cache->mappingSize
+            || header->namesSize != cache->mappingSize - namesOffset
+            || header->namesSize == 0
+            || entriesOffset % sizeof(uint64_t) != 0) {
+        goto fail;
+    }
+    if (memcmp(data + sizeof(CacheFileHeader), cache->libPath, header->pathLength) != 0) {
+        goto fail;
+    }
+
+    cache->entries = (const CacheFileEntry *) (data + entriesOffset);
+    cache->names = data + namesOffset;
+
+    // Make sure that every name is inside the file and terminated, and that
+    // every function is inside the library. Otherwise, a corrupt cache file
+    // could hand us an arbitrary function pointer.
+    if (cache->names[header->namesSize - 1] != '\0') {
+        goto fail;
+    }
+    for (i=0; i<header->count; i++) {
+        if (cache->entries[i].nameOffset >= header->namesSize) {
+            goto fail;
+        }
+        if (cache->entries[i].offset != CACHE_NOT_PRESENT
+                && cache->entries[i].offset >= header->libSize) {
+            goto fail;
+        }
+    }
+    return;
+
+fail:
+    DBG_PRINTF(0, "Ignoring invalid dispatch cache %s\n", cache->cachePath);
+    munmap(cache->mapping, cache->mappingSize);
+    cache->mapping = NULL;
+    cache->entries = NULL;
+    cache->names = NULL;
+}
+
+__GLdispatchCache *__glDispatchCacheOpen(int sampleSlot, const void *sampleProc)
+{
+    __GLdispatchCache *cache;
+    const char *dir = GetCacheDir();
+    Dl_info info;
+    struct stat st;
+
+    if (dir == NULL || sampleProc == NULL) {
+        return NULL;
+    }
+    if (dladdr(sampleProc, &info) == 0 || info.dli_fname == NULL
+            || info.dli_fname[0] != '/' || info.dli_fbase == NULL) {
+        // We need an absolute path to check whether the library changed.
+        return NULL;
+    }
+    if (stat(info.dli_fname, &st) != 0) {
+        return NULL;
+    }
+
+    cache = (__GLdispatchCache *) calloc(1, sizeof(__GLdispatchCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    // Pad the path so that the entries are aligned. The padding is zeroed, so
+    // that the whole path can be compared with memcmp.
+    cache->key.pathLength = (strlen(info.dli_fname) + 1 + 7) & ~7;
+    cache->libPath = (char *) calloc(1, cache->key.pathLength);
+    if (cache->libPath == NULL) {
+        free(cache);
+        return NULL;
+    }
+    strcpy(cache->libPath, info.dli_fname);
+    cache->base = (char *) info.dli_fbase;
+
+    memcpy(cache->key.magic, CACHE_MAGIC, sizeof(cache->key.magic));
+    cache->key.pointerSize = sizeof(void *);
+    cache->key.libSize = st.st_size;
+    cache->key.libMtime = st.st_mtim.tv_sec;
+    cache->key.libMtimeNsec = st.st_mtim.tv_nsec;
+    cache->key.sampleSlot = sampleSlot;
+    cache->key.sampleOffset = (const char *) sampleProc - cache->base;
+
+    if (glvnd_asprintf(&cache->cachePath, "%s/%016llx.cache", dir,
+                (unsigned long long) HashKey(&cache->key, cache->libPath)) < 0) {
+        cache->cachePath = NULL;
+        __glDispatchCacheClose(cache);
+        return NULL;
+    }
+
+    MapCacheFile(cache);
+    return cache;
+}
+
+int __glDispatchCacheLookup(__GLdispatchCache *cache, int slot,
+        const char *name, void **proc)
+{
+    const CacheFileHeader *header;
+    const CacheFileEntry *entry;
+
+    if (cache->mapping == NULL) {
+        return 0;
+    }
+
+    header = (const CacheFileHeader *) cache->mapping;
+    if (slot < 0 || (uint32_t) slot >= header->count) {
+        return 0;
+    }
+
+    // Dynamic slots aren't always assigned in the same order, so make sure
+    // that this is the same function.
+    entry = &cache->entries[slot];
+    if (strcmp(cache->names + entry->nameOffset, name) != 0) {
+        return 0;
+    }
+
+    if (entry->offset == CACHE_NOT_PRESENT) {
+        *proc = NULL;
+    } else {
+        *proc = cache->base + entry->offset;
+    }
+    return 1;
+}
+
+void __glDispatchCacheWrite(__GLdispatchCache *cache, void * const *procs,
+        int count, const void *noop)
+{
+    CacheFileHeader header = cache->key;
+    CacheFileEntry *entries;
+    char *tempPath = NULL;
+    FILE *out = NULL;
+    uint64_t namesSize = 0;
+    int i;
+
+    entries = (CacheFileEntry *) malloc(count * sizeof(CacheFileEntry));
+    if (entries == NULL) {
+        return;
+    }
+
+    for (i=0; i<count; i++) {
+        const char *name = _glapi_get_proc_name(i);
+
+        if (procs[i] == NULL || procs[i] == noop) {
+            entries[i].offset = CACHE_NOT_PRESENT;
+        } else {
+            Dl_info info;
+
+            // Every function has to be in the same library, or else we can't
+            // store it as an offset.
+            if (dladdr(procs[i], &info) == 0 || info.dli_fbase != cache->base) {
+                DBG_PRINTF(0, "Not caching %s: %s is in a different library\n",
+                        cache->libPath, name);
+                goto done;
+            }
+            entries[i].offset = (const char *) procs[i] - cache->base;
+        }
+
+        entries[i].nameOffset = namesSize;
+        namesSize += strlen(name) + 1;
+    }
+
+    header.count = count;
+    header.namesSize = namesSize;
+
+    // Write to a temporary file first, so that another process never sees a
+    // partial cache file.
+    if (glvnd_asprintf(&tempPath, "%s.%d", cache->cachePath, (int) getpid()) < 0) {
+        tempPath = NULL;
+        goto done;
+    }
+    out = fopen(tempPath, "wb");
+    if (out == NULL) {
+        goto done;
+    }
+
+    if (fwrite(&header, sizeof(header), 1, out) != 1
+            || fwrite(cache->libPath, header.pathLength, 1, out) != 1
+            || fwrite(entries, sizeof(CacheFileEntry), count, out) != (size_t) count) {
+        goto done;
+    }
+    for (i=0; i<count; i++) {
+        const char *name = _glapi_get_proc_name(i);
+        if (fwrite(name, strlen(name) + 1, 1, out) != 1) {
+            goto done;
+        }
+    }
+
+    if (fclose(out) == 0) {
+        out = NULL;
+        if (rename(tempPath, cache->cachePath) == 0) {
+            free(tempPath);
+            tempPath = NULL;
+        }
+    } else {
+        out = NULL;
+    }
+
+done:
+    if (out != NULL) {
+        fclose(out);
+    }
+    if (tempPath != NULL) {
+        unlink(tempPath);
+        free(tempPath);
+    }
+    free(entries);
+}
+
+void __glDispatchCacheClose(__GLdispatchCache *cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    if (cache->mapping != NULL) {
+        munmap(cache->mapping, cache->mappingSize);
+    }
+    free(cache->libPath);
+    free(cache->cachePath);
+    free(cache);
+}
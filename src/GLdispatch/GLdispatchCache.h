@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2013, NVIDIA CORPORATION.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and/or associated documentation files (the
+ * "Materials"), to deal in the Materials without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Materials, and to
+ * permit persons to whom the Materials are furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * unaltered in all copies or substantial portions of the Materials.
+ * Any additions, deletions, or changes to the original source files
+ * must be clearly indicated in accompanying documentation.
+ *
+ * If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the
+ * work of the Khronos Group."
+ *
+ * THE MATERIALS ARE PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * MATERIALS OR THE USE OR OTHER DEALINGS IN THE MATERIALS.
+ */
+
+#ifndef __GL_DISPATCH_CACHE_H__
+#define __GL_DISPATCH_CACHE_H__
+
+/*!
+ * \file
+ *
+ * An on-disk cache of the functions that a vendor library returns from its
+ * getProcAddress callback.
+ *
+ * Each cache file covers one vendor library, identified by its path,
+ * modification time, and size. The cache stores each function as an offset
+ * from the library's load address, so it's still valid if the library gets
+ * loaded at a different address.
+ *
+ * The cache is only used if the __GLVND_DISPATCH_CACHE_DIR environment
+ * variable is set, and it assumes that the vendor library returns the same
+ * functions every time, regardless of the parameter passed to its
+ * getProcAddress callback.
+ */
+
+typedef struct __GLdispatchCacheRec __GLdispatchCache;
+
+/*!
+ * Returns non-zero if the dispatch cache is enabled.
+ */
+int __glDispatchCacheIsEnabled(void);
+
+/*!
+ * Opens the cache for a vendor library.
+ *
+ * \param sampleSlot The slot number of \p sampleProc.
+ * \param sampleProc A function that the vendor library returned. This is
+ *      used to find the library, and it's part of the cache key.
+ * \return A cache handle, or NULL if the library can't be cached. The
+ *      handle is still valid if there isn't any cache file yet, in which case
+ *      every lookup will fail.
+ */
+__GLdispatchCache *__glDispatchCacheOpen(int sampleSlot, const void *sampleProc);
+
+/*!
+ * Looks up a function in the cache.
+ *
+ * \param cache The cache handle.
+ * \param slot The dispatch table slot.
+ * \param name The name of the function in \p slot.
+ * \param[out] proc Receives the function, or NULL if the vendor library
+ *      doesn't support it.
+ * \return Non-zero if the function was in the cache.
+ */
+int __glDispatchCacheLookup(__GLdispatchCache *cache, int slot,
+        const char *name, void **proc);
+
+/*!
+ * Writes a new cache file.
+ *
+ * If any function isn't in the same library as the sample function, then
+ * this doesn't write anything.
+ *
+ * \param cache The cache handle.
+ * \param procs The function for each slot. Any slot that's equal to
+ *      \p noop, or NULL, is stored as not supported.
+ * \param count The number of slots to store.
+ * \param noop The no-op function used for unsupported functions.
+ */
+void __glDispatchCacheWrite(__GLdispatchCache *cache, void * const *procs,
+        int count, const void *noop);
+
+/*!
+ * Closes a cache handle.
+ */
+void __glDispatchCacheClose(__GLdispatchCache *cache);
+
+#endif // __GL_DISPATCH_CACHE_H__
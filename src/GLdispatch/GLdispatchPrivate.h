@@ -36,6 +36,14 @@
 #include "entry.h"
 #include "utils_misc.h"
 
+/*!
+ * A function that a derived dispatch table uses in place of its parent's.
+ */
+typedef struct __GLdispatchTableOverrideRec {
+    int slot;
+    void *proc;
+} __GLdispatchTableOverride;
+
 /*!
  * Private dispatch table structure. This is used by GLdispatch for tracking
  * and updating dispatch tables.
@@ -47,16 +55,45 @@ struct __GLdispatchTableRec {
     /*!
      * The number of dispatch table entries that have been populated. This is
      * used to update the table after generating new dispatch stubs.
+     *
+     * This works as a generation count: The table is out of date if this is
+     * less than \c _glapi_get_stub_count. Out of date tables are updated in
+     * \c __glDispatchMakeCurrent, not when the new stub is generated.
      */
     int stubsPopulated;
 
     /*! Saved vendor library callbacks */
     __GLgetProcAddressCallback getProcAddress;
+    __GLgetProcAddressListCallback getProcAddressList;
     void *getProcAddressParam;
 
-    /*! The real dispatch table */
+    /*!
+     * The real dispatch table.
+     *
+     * For a derived table with no overrides, this is the same as
+     * \c parent->table.
+     */
     struct _glapi_table *table;
 
+    /*! The table that this one was derived from, or NULL. */
+    __GLdispatchTable *parent;
+
+    /*! The functions that a derived table replaces. */
+    __GLdispatchTableOverride *overrides;
+    int numOverrides;
+
+    /*!
+     * The tables for each registered layer, starting with the innermost one.
+     * Each layer's table is a copy of the table below it, with the layer's
+     * own functions plugged in. The innermost layer's table is built on top
+     * of \c table, and the outermost one is the table that's made current.
+     */
+    struct _glapi_table **layerTables;
+    int numLayerTables;
+
+    /*! The layer generation that \c layerTables was built for. */
+    int layerGeneration;
+
     /*! List handle */
     struct glvnd_list entry;
 };
@@ -41,12 +41,14 @@ entry_init_public(void);
 /**
  * Returns the address of an entrypoint.
  *
- * Note that \p index is the index into the array of public stubs, not the slot
- * in the dispatch table. The public stub array may be different depending on
- * which library is being built. For example, the array in libOpenGL.so is a
- * subset of the array in libGLdispatch.so.
+ * Note that \p index is the position of the entrypoint in the stub layout,
+ * not the slot in the dispatch table. The layout may be different depending
+ * on which library is being built. For example, the layout in libOpenGL.so is
+ * a subset of the layout in libGLdispatch.so. The layout may also be in a
+ * different order than the public stub array, so use public_stub_layout to
+ * find the position of a stub.
  *
- * \param index The index into the public stub table.
+ * \param index The position of the entrypoint.
  * \return A pointer to the function, suitable to hand back from
  * glX/eglGetProcAddress.
  */
@@ -69,23 +71,157 @@ entry_generate(int slot);
 void
 entry_generate_default_code(char *entry, int slot);
 
+/**
+ * Returns a stub that can be stored in a dispatch table in place of the real
+ * function for a slot.
+ *
+ * When the stub is called, it calls \c entry_resolve_slot to look up the real
+ * function, and then jumps to it with the original arguments.
+ *
+ * \param slot The slot in the dispatch table.
+ * \return The resolver stub, or NULL if lazy resolving isn't supported for
+ * this entrypoint type or for this slot.
+ */
+mapi_func
+entry_get_lazy_resolver(int slot);
+
+/**
+ * Looks up the real function for a dispatch table slot. This is called from
+ * the stubs returned by \c entry_get_lazy_resolver, and is defined in
+ * mapi_glapi.c.
+ */
+mapi_func
+entry_resolve_slot(int slot);
+
+/**
+ * Returns a stub that counts a call to a function and then calls it.
+ *
+ * When the stub is called, it calls \c entry_count_slot, and then jumps to
+ * the function that it returns with the original arguments.
+ *
+ * \param slot The slot in the dispatch table.
+ * \return The counting stub, or NULL if call counting isn't supported for
+ * this entrypoint type or for this slot.
+ */
+mapi_func
+entry_get_count_thunk(int slot);
+
+/**
+ * Counts a call for a dispatch table slot, and returns the function to call.
+ * This is called from the stubs returned by \c entry_get_count_thunk, and is
+ * defined in mapi_glapi.c.
+ */
+mapi_func
+entry_count_slot(int slot);
+
 /**
  * Called before starting entrypoint patching.
  *
- * This function will generally call mprotect(2) to make the static entrypoints
- * writable.
+ * This doesn't change any memory protections by itself. Instead, the caller
+ * uses \c entry_patch_add and \c entry_patch_unprotect to make only the
+ * pages that it's going to write to writable.
  *
  * \return Non-zero on success, zero on failure.
  */
 int entry_patch_start(void);
 
+/**
+ * Adds an entrypoint to the set of entrypoints that are about to be
+ * modified. The page containing it is made writable on the next call to
+ * \c entry_patch_unprotect.
+ *
+ * \param entry The entrypoint, as returned from \c entry_get_public or
+ * \c entry_generate.
+ */
+void entry_patch_add(mapi_func entry);
+
+/**
+ * Calls mprotect(2) to make the pages for every entrypoint passed to
+ * \c entry_patch_add writable, with one call for each run of contiguous
+ * pages.
+ *
+ * If this fails, then the caller must not write to any entrypoints, and must
+ * call \c entry_patch_finish.
+ *
+ * \return Non-zero on success, zero on failure.
+ */
+int entry_patch_unprotect(void);
+
 /**
  * Called after the vendor library finishes patching the entrypoints.
  *
+ * This makes any pages that \c entry_patch_unprotect made writable
+ * read-only again.
+ *
  * \return Non-zero on success, zero on failure.
  */
 int entry_patch_finish(void);
 
+/**
+ * Called before patching the entrypoints while other threads might be
+ * calling them.
+ *
+ * Instead of writing directly to an entrypoint, a vendor library writes its
+ * code to a trampoline from \c entry_patch_get_trampoline. Then,
+ * \c entry_patch_redirect switches the entrypoint over to the trampoline
+ * with a single atomic store.
+ *
+ * \return Non-zero on success, or zero if live patching isn't supported.
+ */
+int entry_patch_live_start(void);
+
+/**
+ * Allocates a trampoline for an entrypoint during a live patch.
+ *
+ * \param[in] entry The entrypoint to patch.
+ * \param[in] slot The dispatch table slot for \p entry.
+ * \param[out] writePtr The address that the vendor library can write to.
+ * \param[out] execPtr An executable mapping of \p writePtr.
+ * \return Non-zero on success, or zero if \p entry can't be redirected.
+ */
+int entry_patch_get_trampoline(mapi_func entry, int slot,
+        void **writePtr, const void **execPtr);
+
+/**
+ * Sets the function that \c entry_patch_redirect will jump to for an
+ * entrypoint, instead of a trampoline.
+ *
+ * \param entry The entrypoint to redirect.
+ * \param slot The dispatch table slot for \p entry.
+ * \param target The function to jump to.
+ * \return Non-zero on success, or zero if \p entry can't be redirected.
+ */
+int entry_patch_set_target(mapi_func entry, int slot, const void *target);
+
+/**
+ * Switches an entrypoint to jump to the last trampoline from
+ * \c entry_patch_get_trampoline or target from \c entry_patch_set_target
+ * for its slot.
+ *
+ * The page containing the entrypoint must be writable, and the caller should
+ * call \c entry_patch_sync before and after.
+ */
+void entry_patch_redirect(mapi_func entry, int slot);
+
+/**
+ * Undoes \c entry_patch_redirect, which is safe even while other threads are
+ * calling the entrypoint.
+ */
+void entry_patch_unredirect(mapi_func entry, int slot);
+
+/**
+ * Makes sure that every other thread sees any code written so far.
+ */
+void entry_patch_sync(void);
+
+/**
+ * Frees every trampoline.
+ *
+ * This must only be called when no entrypoints are redirected, and no other
+ * thread could still be running a trampoline.
+ */
+void entry_patch_free_trampolines(void);
+
 /**
  * Returns the addresses for an entrypoint that a vendor library can patch.
  *
@@ -229,4 +229,14 @@ mapi_func entry_generate(int slot)
 
     return (mapi_func) code;
 }
+
+mapi_func entry_get_lazy_resolver(int slot)
+{
+    return NULL;
+}
+
+mapi_func entry_get_count_thunk(int slot)
+{
+    return NULL;
+}
 #endif // !defined(STATIC_DISPATCH_ONLY)
@@ -28,6 +28,7 @@
 #include "entry.h"
 #include "entry_common.h"
 
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 #include <sys/mman.h>
@@ -39,38 +40,404 @@
 #include "u_current.h"
 #include "utils_misc.h"
 
-static int entry_patch_mprotect(int prot)
+/*
+ * The state of each page in the public entrypoint range. This is allocated
+ * the first time that entry_patch_start is called.
+ */
+enum {
+    PATCH_PAGE_READONLY = 0,
+    PATCH_PAGE_PENDING,
+    PATCH_PAGE_WRITABLE,
+};
+static unsigned char *patch_pages = NULL;
+static size_t patch_page_count = 0;
+static size_t patch_page_size = 0;
+
+/*
+ * Set if any pages are in the PATCH_PAGE_PENDING state.
+ */
+static int patch_pages_pending = 0;
+
+/*
+ * Calls mprotect on every run of contiguous pages that are in the state
+ * \p from, and changes them to the state \p to.
+ */
+static int entry_patch_mprotect(unsigned char from, unsigned char to, int prot)
 {
-    size_t size;
-    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t first, last;
+    int ret = 1;
 
-    if (((uintptr_t) public_entry_start) % pageSize != 0
-            || ((uintptr_t) public_entry_end) % pageSize != 0) {
-        assert(((uintptr_t) public_entry_start) % pageSize == 0);
-        assert(((uintptr_t) public_entry_end) % pageSize == 0);
-        return 0;
+    for (first = 0; first < patch_page_count; first = last) {
+        if (patch_pages[first] != from) {
+            last = first + 1;
+            continue;
+        }
+        for (last = first + 1; last < patch_page_count
+                && patch_pages[last] == from; last++) {
+        }
+
+        if (mprotect(public_entry_start + first * patch_page_size,
+                    (last - first) * patch_page_size, prot) == 0) {
+            memset(patch_pages + first, to, last - first);
+        } else {
+            ret = 0;
+        }
     }
+    return ret;
+}
+
+int entry_patch_start(void)
+{
+    if (patch_pages == NULL) {
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
 
-    size = ((uintptr_t) public_entry_end) - ((uintptr_t) public_entry_start);
+        if (((uintptr_t) public_entry_start) % pageSize != 0
+                || ((uintptr_t) public_entry_end) % pageSize != 0) {
+            assert(((uintptr_t) public_entry_start) % pageSize == 0);
+            assert(((uintptr_t) public_entry_end) % pageSize == 0);
+            return 0;
+        }
 
-    if (mprotect(public_entry_start, size, prot) != 0) {
-        return 0;
+        patch_page_count = (public_entry_end - public_entry_start) / pageSize;
+        patch_pages = calloc(patch_page_count ? patch_page_count : 1, 1);
+        if (patch_pages == NULL) {
+            return 0;
+        }
+        patch_page_size = pageSize;
     }
     return 1;
 }
 
-int entry_patch_start(void)
+void entry_patch_add(mapi_func entry)
 {
+    void *writePtr;
+    const void *execPtr;
+    const char *start, *end;
+    size_t first, last;
+
+    entry_get_patch_addresses(entry, &writePtr, &execPtr);
+    start = (const char *) execPtr;
+    end = start + entry_stub_size;
+
+    // Generated stubs don't need an mprotect call, because they've already
+    // got a writable mapping.
+    if (start < public_entry_start || end > public_entry_end) {
+        return;
+    }
+    assert(patch_pages != NULL);
+
+    first = (start - public_entry_start) / patch_page_size;
+    last = (end - 1 - public_entry_start) / patch_page_size;
+    for (; first <= last; first++) {
+        if (patch_pages[first] == PATCH_PAGE_READONLY) {
+            patch_pages[first] = PATCH_PAGE_PENDING;
+            patch_pages_pending = 1;
+        }
+    }
+}
+
+int entry_patch_unprotect(void)
+{
+    if (!patch_pages_pending) {
+        return 1;
+    }
+    patch_pages_pending = 0;
+
     // Set the memory protections to read/write/exec.
     // Since this only gets called when no thread has a current context, this
     // could also just be read/write, without exec, and then set it back to
     // read/exec afterward. But then, if the first mprotect succeeds and the
     // second fails, we'll be left with un-executable entrypoints.
-    return entry_patch_mprotect(PROT_READ | PROT_WRITE | PROT_EXEC);
+    if (!entry_patch_mprotect(PATCH_PAGE_PENDING, PATCH_PAGE_WRITABLE,
+                PROT_READ | PROT_WRITE | PROT_EXEC)) {
+        // Don't leave any pages pending, so that the next call doesn't
+        // treat them as writable.
+        size_t i;
+        for (i = 0; i < patch_page_count; i++) {
+            if (patch_pages[i] == PATCH_PAGE_PENDING) {
+                patch_pages[i] = PATCH_PAGE_READONLY;
+            }
+        }
+        return 0;
+    }
+    return 1;
 }
 
 int entry_patch_finish(void)
 {
-    return entry_patch_mprotect(PROT_READ | PROT_EXEC);
+    assert(!patch_pages_pending);
+    return entry_patch_mprotect(PATCH_PAGE_WRITABLE, PATCH_PAGE_READONLY,
+            PROT_READ | PROT_EXEC);
+}
+
+
+/*
+ * Live patching.
+ *
+ * To patch the entrypoints while other threads might be running them, the
+ * vendor library writes its code into a separate trampoline instead of into
+ * the entrypoint itself. Then, we replace the first instruction of each
+ * entrypoint with a "jmp *target(%rip)" instruction, which jumps through
+ * patch_targets to the trampoline.
+ *
+ * The jump is 6 bytes, so it only ever overwrites the first instruction of
+ * the entrypoint, and it's written with a single aligned 8-byte store. Any
+ * thread that's already past the first instruction will finish running the
+ * old code, and any thread that starts after the store will jump to the
+ * trampoline. The rest of the entrypoint is never modified, so restoring it
+ * just means storing the original 8 bytes again. If the target is close
+ * enough, then we use a 5-byte "jmp rel32" instead, which skips the load from
+ * patch_targets.
+ *
+ * The same thing works for any other target, too, so libGLdispatch can also
+ * use it to redirect the entrypoints straight to a vendor's functions with
+ * entry_patch_set_target.
+ *
+ * A membarrier(2) call with MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE makes
+ * every other thread execute a serializing instruction, so that they all see
+ * the trampolines before we start writing the jumps, and see the jumps once
+ * we're done.
+ */
+#if defined(__x86_64__) && !defined(__ILP32__) && defined(__linux__) \
+    && HAVE_DECL_MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE
+#define ENTRY_PATCH_LIVE 1
+#endif
+
+#if defined(ENTRY_PATCH_LIVE)
+
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+#include "table.h"
+
+#if defined(STATIC_DISPATCH_ONLY)
+#define PATCH_TARGET_COUNT MAPI_TABLE_NUM_STATIC
+#else
+#define PATCH_TARGET_COUNT MAPI_TABLE_NUM_SLOTS
+#endif
+
+#define REDIRECT_SIZE 6
+#define TRAMPOLINE_BLOCK_SIZE (64 * 1024)
+
+/*
+ * The trampoline and the original first 8 bytes for each slot. This has to be
+ * a static array, so that it's within 2GB of the public entrypoints.
+ */
+static struct {
+    const void *target;
+    uint64_t saved;
+} patch_targets[PATCH_TARGET_COUNT];
+
+struct patch_trampoline_block {
+    struct patch_trampoline_block *next;
+    size_t used;
+    void *writePtr;
+    void *execPtr;
+};
+static struct patch_trampoline_block *patch_trampolines = NULL;
+
+/*
+ * Returns the length of the first instruction in an entrypoint, or zero if
+ * it's not an instruction that we recognize.
+ */
+static int entry_patch_first_insn_size(const void *entry)
+{
+    static const struct {
+        unsigned char prefix[5];
+        int prefixSize;
+        int size;
+    } KNOWN_INSNS[] = {
+        { { 0x48, 0x8b, 0x05 }, 3, 7 },             // movq disp32(%rip), %rax
+        { { 0x41, 0xbb }, 2, 6 },                   // movl $imm32, %r11d
+        { { 0x64, 0x4c, 0x8b, 0x1c, 0x25 }, 5, 9 }, // movq %fs:abs32, %r11
+        { { 0x48, 0xa1 }, 2, 10 },                  // movabs moffs64, %rax
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(KNOWN_INSNS) / sizeof(KNOWN_INSNS[0]); i++) {
+        if (memcmp(entry, KNOWN_INSNS[i].prefix, KNOWN_INSNS[i].prefixSize) == 0) {
+            return KNOWN_INSNS[i].size;
+        }
+    }
+    return 0;
+}
+
+static int entry_patch_membarrier(int cmd)
+{
+    return syscall(SYS_membarrier, cmd, 0);
+}
+
+int entry_patch_live_start(void)
+{
+    static int supported = -1;
+
+    if (!entry_patch_start()) {
+        return 0;
+    }
+
+    if (supported < 0) {
+        // Check the first public stub, so that we don't bother with a
+        // type of stub that we can't redirect, like the TLSDESC stubs.
+        int cmds = entry_patch_membarrier(MEMBARRIER_CMD_QUERY);
+        supported = (patch_page_count > 0
+                && entry_patch_first_insn_size(public_entry_start) >= REDIRECT_SIZE
+                && cmds >= 0
+                && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE)
+                && entry_patch_membarrier(MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED_SYNC_CORE) == 0);
+    }
+    return supported;
+}
+
+/*
+ * Returns non-zero if entry_patch_redirect can work with an entrypoint.
+ */
+static int entry_patch_can_redirect(mapi_func entry, int slot)
+{
+    void *entryWrite;
+    const void *entryExec;
+    intptr_t disp;
+
+    if (slot < 0 || slot >= PATCH_TARGET_COUNT) {
+        return 0;
+    }
+
+    entry_get_patch_addresses(entry, &entryWrite, &entryExec);
+    disp = ((intptr_t) &patch_targets[slot].target)
+        - ((intptr_t) entryExec + REDIRECT_SIZE);
+    return (((uintptr_t) entryExec) % sizeof(uint64_t) == 0
+            && disp == (int32_t) disp
+            && entry_patch_first_insn_size(entryExec) >= REDIRECT_SIZE);
+}
+
+int entry_patch_get_trampoline(mapi_func entry, int slot,
+        void **writePtr, const void **execPtr)
+{
+    struct patch_trampoline_block *block = patch_trampolines;
+
+    if (!entry_patch_can_redirect(entry, slot)) {
+        return 0;
+    }
+
+    // Always hand out new memory, since another thread could still be
+    // running an old trampoline.
+    if (block == NULL || block->used + entry_stub_size > TRAMPOLINE_BLOCK_SIZE) {
+        block = malloc(sizeof(*block));
+        if (block == NULL) {
+            return 0;
+        }
+        if (AllocExecPages(TRAMPOLINE_BLOCK_SIZE, &block->writePtr, &block->execPtr) != 0) {
+            free(block);
+            return 0;
+        }
+        block->used = 0;
+        block->next = patch_trampolines;
+        patch_trampolines = block;
+    }
+
+    *writePtr = ((char *) block->writePtr) + block->used;
+    *execPtr = ((char *) block->execPtr) + block->used;
+    block->used += entry_stub_size;
+
+    patch_targets[slot].target = *execPtr;
+    return 1;
+}
+
+int entry_patch_set_target(mapi_func entry, int slot, const void *target)
+{
+    if (!entry_patch_can_redirect(entry, slot)) {
+        return 0;
+    }
+    patch_targets[slot].target = target;
+    return 1;
+}
+
+void entry_patch_redirect(mapi_func entry, int slot)
+{
+    void *entryWrite;
+    const void *entryExec;
+    uint64_t saved;
+    intptr_t rel;
+    int32_t disp;
+
+    entry_get_patch_addresses(entry, &entryWrite, &entryExec);
+    saved = *((const volatile uint64_t *) entryExec);
+    patch_targets[slot].saved = saved;
+
+    // An aligned 8-byte store is atomic on x86-64.
+    rel = ((intptr_t) patch_targets[slot].target)
+        - ((intptr_t) entryExec + 5);
+    if (rel == (int32_t) rel) {
+        // Keep the last three bytes, and replace the rest with "jmp rel32".
+        *((volatile uint64_t *) entryWrite) = (saved & 0xFFFFFF0000000000ULL)
+            | (((uint64_t) (uint32_t) rel) << 8) | 0xE9;
+    } else {
+        // Keep the last two bytes, and replace the rest with
+        // "jmp *disp(%rip)".
+        disp = (int32_t) (((intptr_t) &patch_targets[slot].target)
+            - ((intptr_t) entryExec + REDIRECT_SIZE));
+        *((volatile uint64_t *) entryWrite) = (saved & 0xFFFF000000000000ULL)
+            | (((uint64_t) (uint32_t) disp) << 16) | 0x25FF;
+    }
+}
+
+void entry_patch_unredirect(mapi_func entry, int slot)
+{
+    void *entryWrite;
+    const void *entryExec;
+
+    entry_get_patch_addresses(entry, &entryWrite, &entryExec);
+    *((volatile uint64_t *) entryWrite) = patch_targets[slot].saved;
+}
+
+void entry_patch_sync(void)
+{
+    entry_patch_membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE);
+}
+
+void entry_patch_free_trampolines(void)
+{
+    while (patch_trampolines != NULL) {
+        struct patch_trampoline_block *block = patch_trampolines;
+        patch_trampolines = block->next;
+        FreeExecPages(TRAMPOLINE_BLOCK_SIZE, block->writePtr, block->execPtr);
+        free(block);
+    }
+}
+
+#else // defined(ENTRY_PATCH_LIVE)
+
+int entry_patch_live_start(void)
+{
+    return 0;
+}
+
+int entry_patch_get_trampoline(mapi_func entry, int slot,
+        void **writePtr, const void **execPtr)
+{
+    return 0;
+}
+
+int entry_patch_set_target(mapi_func entry, int slot, const void *target)
+{
+    return 0;
+}
+
+void entry_patch_redirect(mapi_func entry, int slot)
+{
+    assert(!"This should never be called");
+}
+
+void entry_patch_unredirect(mapi_func entry, int slot)
+{
+    assert(!"This should never be called");
+}
+
+void entry_patch_sync(void)
+{
+}
+
+void entry_patch_free_trampolines(void)
+{
 }
 
+#endif // defined(ENTRY_PATCH_LIVE)
@@ -20,6 +20,12 @@ MAPI_GLDISPATCH_ENTRY_FILES += entry_x86_64_common.c
 MAPI_GLDISPATCH_ENTRY_FILES += entry_common.c
 endif
 
+if GLDISPATCH_TYPE_X86_64_TLSDESC
+MAPI_GLDISPATCH_ENTRY_FILES = entry_x86_64_tlsdesc.c
+MAPI_GLDISPATCH_ENTRY_FILES += entry_x86_64_common.c
+MAPI_GLDISPATCH_ENTRY_FILES += entry_common.c
+endif
+
 if GLDISPATCH_TYPE_X86_64_TSD
 MAPI_GLDISPATCH_ENTRY_FILES = entry_x86_64_tsd.c
 MAPI_GLDISPATCH_ENTRY_FILES += entry_x86_64_common.c
@@ -76,12 +76,59 @@ int entry_patch_start(void)
     return 0;
 }
 
+void entry_patch_add(mapi_func entry)
+{
+    assert(!"This should never be called");
+}
+
+int entry_patch_unprotect(void)
+{
+    assert(!"This should never be called");
+    return 0;
+}
+
 int entry_patch_finish(void)
 {
     assert(!"This should never be called");
     return 0;
 }
 
+int entry_patch_live_start(void)
+{
+    return 0;
+}
+
+int entry_patch_get_trampoline(mapi_func entry, int slot,
+        void **writePtr, const void **execPtr)
+{
+    assert(!"This should never be called");
+    return 0;
+}
+
+int entry_patch_set_target(mapi_func entry, int slot, const void *target)
+{
+    assert(!"This should never be called");
+    return 0;
+}
+
+void entry_patch_redirect(mapi_func entry, int slot)
+{
+    assert(!"This should never be called");
+}
+
+void entry_patch_unredirect(mapi_func entry, int slot)
+{
+    assert(!"This should never be called");
+}
+
+void entry_patch_sync(void)
+{
+}
+
+void entry_patch_free_trampolines(void)
+{
+}
+
 void entry_get_patch_addresses(mapi_func entry, void **writePtr, const void **execPtr)
 {
     assert(!"This should never be called");
@@ -95,4 +142,16 @@ entry_generate(int slot)
 {
    return NULL;
 }
+
+mapi_func
+entry_get_lazy_resolver(int slot)
+{
+   return NULL;
+}
+
+mapi_func
+entry_get_count_thunk(int slot)
+{
+   return NULL;
+}
 #endif // !defined(STATIC_DISPATCH_ONLY)
@@ -37,7 +37,9 @@
 #include "glapi.h"
 #include "u_macros.h"
 #include "u_current.h"
+#include "table.h"
 #include "utils_misc.h"
+#include "glvnd_pthread.h"
 
 /**
  * \file
@@ -76,4 +78,194 @@ mapi_func entry_generate(int slot)
 
     return (mapi_func) code;
 }
+
+#if defined(__x86_64__)
+
+/*
+ * The lazy resolver stubs and the call counting stubs. There's one stub for
+ * each slot, which just loads the slot number into %r11d and jumps to a common
+ * routine.
+ *
+ * The common routine saves the argument registers, calls a C function to find
+ * the real function, and then restores the arguments and jumps to the real
+ * function. That way, the real function returns directly to the application.
+ *
+ * Note that the dispatch stubs already clobber %rax and %r11, so we don't
+ * need to preserve them here.
+ */
+#define X86_64_SLOT_THUNK_COMMON(name, func) \
+        ".text\n" \
+        ".balign 16\n" \
+        ".globl " name "\n" \
+        ".hidden " name "\n" \
+        name ":\n\t" \
+        "pushq %rdi\n\t" \
+        "pushq %rsi\n\t" \
+        "pushq %rdx\n\t" \
+        "pushq %rcx\n\t" \
+        "pushq %r8\n\t" \
+        "pushq %r9\n\t" \
+        /* Six pushes plus the return address leaves the stack 8 bytes off */ \
+        /* from a 16-byte boundary, so allocate an extra 8 bytes here. */ \
+        "subq $136, %rsp\n\t" \
+        "movaps %xmm0, 0(%rsp)\n\t" \
+        "movaps %xmm1, 16(%rsp)\n\t" \
+        "movaps %xmm2, 32(%rsp)\n\t" \
+        "movaps %xmm3, 48(%rsp)\n\t" \
+        "movaps %xmm4, 64(%rsp)\n\t" \
+        "movaps %xmm5, 80(%rsp)\n\t" \
+        "movaps %xmm6, 96(%rsp)\n\t" \
+        "movaps %xmm7, 112(%rsp)\n\t" \
+        "movl %r11d, %edi\n\t" \
+        "call " func "\n\t" \
+        "movq %rax, %r11\n\t" \
+        "movaps 0(%rsp), %xmm0\n\t" \
+        "movaps 16(%rsp), %xmm1\n\t" \
+        "movaps 32(%rsp), %xmm2\n\t" \
+        "movaps 48(%rsp), %xmm3\n\t" \
+        "movaps 64(%rsp), %xmm4\n\t" \
+        "movaps 80(%rsp), %xmm5\n\t" \
+        "movaps 96(%rsp), %xmm6\n\t" \
+        "movaps 112(%rsp), %xmm7\n\t" \
+        "addq $136, %rsp\n\t" \
+        "popq %r9\n\t" \
+        "popq %r8\n\t" \
+        "popq %rcx\n\t" \
+        "popq %rdx\n\t" \
+        "popq %rsi\n\t" \
+        "popq %rdi\n\t" \
+        "jmp *%r11\n"
+
+/*
+ * The number of slots that get a stub. This covers the static slots and the
+ * first 4096 dynamic slots, which is far more than any real application uses.
+ * Any slot after that just doesn't get a lazy resolver or a call counting
+ * stub.
+ */
+#define SLOT_THUNK_COUNT (MAPI_TABLE_NUM_STATIC + 4096)
+
+/*
+ * The per-slot stubs aren't built into the library, since they'd take up a
+ * few hundred KB and most processes never use them. Instead, they're generated
+ * a page at a time, the first time that a slot in that page is needed.
+ *
+ * The generated stubs might not be within 2GB of the common routine, so they
+ * use an indirect jump with the 64-bit address right after it.
+ */
+static const unsigned char SLOT_THUNK_TEMPLATE[] = {
+    0x41, 0xbb, 0x00, 0x00, 0x00, 0x00, // movl $slot, %r11d
+    0xff, 0x25, 0x00, 0x00, 0x00, 0x00, // jmp *0(%rip)
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // .quad common
+};
+static const unsigned int SLOT_THUNK_SLOT_OFFSET = 2;
+static const unsigned int SLOT_THUNK_ADDR_OFFSET = 12;
+
+#define SLOT_THUNK_SIZE 32
+#define SLOT_THUNK_BLOCK_SIZE 4096
+#define SLOT_THUNKS_PER_BLOCK (SLOT_THUNK_BLOCK_SIZE / SLOT_THUNK_SIZE)
+#define SLOT_THUNK_BLOCK_COUNT \
+    ((SLOT_THUNK_COUNT + SLOT_THUNKS_PER_BLOCK - 1) / SLOT_THUNKS_PER_BLOCK)
+
+/**
+ * The generated stubs for one common routine.
+ *
+ * The blocks are never freed, since a dispatch table or a layer could still
+ * point to one of the stubs.
+ */
+struct slot_thunks {
+    const char *common;
+    char * volatile blocks[SLOT_THUNK_BLOCK_COUNT];
+};
+
+static glvnd_mutex_t slot_thunk_mutex = GLVND_MUTEX_INITIALIZER;
+
+static char *generate_slot_thunks(const char *common, int first)
+{
+    void *writePtr, *execPtr;
+    int i;
+
+    STATIC_ASSERT(SLOT_THUNK_SIZE >= sizeof(SLOT_THUNK_TEMPLATE));
+
+    if (AllocExecPages(SLOT_THUNK_BLOCK_SIZE, &writePtr, &execPtr) != 0) {
+        return NULL;
+    }
+
+    for (i=0; i<SLOT_THUNKS_PER_BLOCK; i++) {
+        unsigned char *code = ((unsigned char *) writePtr) + (i * SLOT_THUNK_SIZE);
+
+        memset(code, 0xcc, SLOT_THUNK_SIZE);
+        memcpy(code, SLOT_THUNK_TEMPLATE, sizeof(SLOT_THUNK_TEMPLATE));
+        *((uint32_t *) &code[SLOT_THUNK_SLOT_OFFSET]) = (uint32_t) (first + i);
+        *((uint64_t *) &code[SLOT_THUNK_ADDR_OFFSET]) = (uint64_t) (uintptr_t) common;
+    }
+    return (char *) execPtr;
+}
+
+static mapi_func get_slot_thunk(struct slot_thunks *thunks, int slot)
+{
+    int index;
+    char *block;
+
+    if (slot < 0 || slot >= SLOT_THUNK_COUNT) {
+        return NULL;
+    }
+
+    index = slot / SLOT_THUNKS_PER_BLOCK;
+    block = thunks->blocks[index];
+    if (block == NULL) {
+        __glvndPthreadFuncs.mutex_lock(&slot_thunk_mutex);
+        block = thunks->blocks[index];
+        if (block == NULL) {
+            block = generate_slot_thunks(thunks->common,
+                    index * SLOT_THUNKS_PER_BLOCK);
+            if (block != NULL) {
+                // Another thread could look up a stub without taking the
+                // mutex, so make sure it can't see the block before the code.
+                __sync_synchronize();
+                thunks->blocks[index] = block;
+            }
+        }
+        __glvndPthreadFuncs.mutex_unlock(&slot_thunk_mutex);
+        if (block == NULL) {
+            return NULL;
+        }
+    }
+    return (mapi_func) (block + ((slot % SLOT_THUNKS_PER_BLOCK) * SLOT_THUNK_SIZE));
+}
+
+__asm__(X86_64_SLOT_THUNK_COMMON("x86_64_lazy_resolve_common", "entry_resolve_slot"));
+
+extern char x86_64_lazy_resolve_common[];
+
+static struct slot_thunks lazy_resolve_thunks = { x86_64_lazy_resolve_common };
+
+__asm__(X86_64_SLOT_THUNK_COMMON("x86_64_count_common", "entry_count_slot"));
+
+extern char x86_64_count_common[];
+
+static struct slot_thunks count_thunks = { x86_64_count_common };
+
+mapi_func entry_get_lazy_resolver(int slot)
+{
+    return get_slot_thunk(&lazy_resolve_thunks, slot);
+}
+
+mapi_func entry_get_count_thunk(int slot)
+{
+    return get_slot_thunk(&count_thunks, slot);
+}
+
+#else // defined(__x86_64__)
+
+mapi_func entry_get_lazy_resolver(int slot)
+{
+    return NULL;
+}
+
+mapi_func entry_get_count_thunk(int slot)
+{
+    return NULL;
+}
+
+#endif // defined(__x86_64__)
 #endif // !defined(STATIC_DISPATCH_ONLY)
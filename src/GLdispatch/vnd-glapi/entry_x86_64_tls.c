@@ -36,9 +36,21 @@
 #include "utils_misc.h"
 #include "u_macros.h"
 #include "glapi.h"
+#include "table.h"
 #include "glvnd/GLdispatchABI.h"
 
+/*
+ * With GLDISPATCH_COMPACT_STUBS, each stub is only 16 bytes, which halves the
+ * size of the entrypoint section. That leaves less room for a vendor library
+ * to patch the stubs, though, so it's not the default. x32 always uses 32-byte
+ * stubs.
+ */
+#if defined(GLDISPATCH_COMPACT_STUBS) && !defined(__ILP32__)
+#define ENTRY_COMPACT_STUBS 1
+#define ENTRY_STUB_SIZE 16
+#else
 #define ENTRY_STUB_SIZE 32
+#endif
 
 __asm__(".section wtext,\"ax\",@progbits\n");
 __asm__(".balign 4096\n"
@@ -60,6 +72,17 @@ __asm__(".balign 4096\n"
    "movl 4*" slot "(%r11d), %r11d\n\t"                   \
    "jmp *%r11"
 
+#elif defined(ENTRY_COMPACT_STUBS)
+
+/*
+ * Loading the current table and jumping through it takes 18 bytes, which
+ * won't fit in a 16-byte stub. Instead, each stub loads the offset of its slot
+ * and jumps to x86_64_entry_tail, which does the rest.
+ */
+#define STUB_ASM_CODE(slot)                                 \
+   "movl $(8 * " slot "), %r11d\n\t"                       \
+   "jmp x86_64_entry_tail"
+
 #else // __ILP32__
 
 #define STUB_ASM_CODE(slot)                                 \
@@ -79,6 +102,14 @@ __asm__(".balign 4096\n"
 
 __asm__(".text\n");
 
+#if defined(ENTRY_COMPACT_STUBS)
+__asm__(".balign 16\n"
+        "x86_64_entry_tail:\n\t"
+        "movq _glapi_tls_Current@GOTTPOFF(%rip), %rax\n\t"
+        "movq %fs:(%rax), %rax\n\t"
+        "jmp *(%rax,%r11)");
+#endif
+
 __asm__("x86_64_current_tls:\n\t"
 	"movq _glapi_tls_Current@GOTTPOFF(%rip), %rax\n\t"
 	"ret");
@@ -100,10 +131,22 @@ static const unsigned char ENTRY_TEMPLATE[] = {
 static const unsigned int TLS_ADDR_OFFSET = 5;
 static const unsigned int SLOT_OFFSET = 13;
 
+#if defined(GLDISPATCH_SPARSE_TABLES)
+static const unsigned char DYNAMIC_ENTRY_TEMPLATE[] = {
+    0x64, 0x44, 0x8b, 0x1c, 0x25, 0x00, 0x00, 0x00, 0x00, // movl %fs:0, %r11d
+    0x67, 0x45, 0x8b, 0x9b, 0x34, 0x12, 0x00, 0x00,       // movl 0x1234(%r11d), %r11d
+    0x67, 0x45, 0x8b, 0x9b, 0x34, 0x12, 0x00, 0x00,       // movl 0x1234(%r11d), %r11d
+    0x41, 0xff, 0xe3,                                     // jmp *%r11
+};
+static const unsigned int DYNAMIC_BLOCK_OFFSET = 13;
+static const unsigned int DYNAMIC_SLOT_OFFSET = 21;
+#endif
+
 #else // __ILP32__
 
 const int entry_type = __GLDISPATCH_STUB_X86_64;
 
+// This is 16 bytes, so it still fits with GLDISPATCH_COMPACT_STUBS.
 static const unsigned char ENTRY_TEMPLATE[] = {
     0x64, 0x4c, 0x8b, 0x1c, 0x25, 0x00, 0x00, 0x00, 0x00, // movq %fs:0, %r11
     0x41, 0xff, 0xa3, 0x34, 0x12, 0x00, 0x00,             // jmp *0x1234(%r11)
@@ -111,6 +154,16 @@ static const unsigned char ENTRY_TEMPLATE[] = {
 static const unsigned int TLS_ADDR_OFFSET = 5;
 static const unsigned int SLOT_OFFSET = 12;
 
+#if defined(GLDISPATCH_SPARSE_TABLES)
+static const unsigned char DYNAMIC_ENTRY_TEMPLATE[] = {
+    0x64, 0x4c, 0x8b, 0x1c, 0x25, 0x00, 0x00, 0x00, 0x00, // movq %fs:0, %r11
+    0x4d, 0x8b, 0x9b, 0x34, 0x12, 0x00, 0x00,             // movq 0x1234(%r11), %r11
+    0x41, 0xff, 0xa3, 0x34, 0x12, 0x00, 0x00,             // jmp *0x1234(%r11)
+};
+static const unsigned int DYNAMIC_BLOCK_OFFSET = 12;
+static const unsigned int DYNAMIC_SLOT_OFFSET = 19;
+#endif
+
 #endif // __ILP32__
 
 void entry_generate_default_code(char *entry, int slot)
@@ -124,6 +177,24 @@ void entry_generate_default_code(char *entry, int slot)
 
     tls_addr = x86_64_current_tls();
 
+#if defined(GLDISPATCH_SPARSE_TABLES)
+    /*
+     * With sparse tables, the dynamic slots are in a separate block, so the
+     * stub has to load the pointer to that block from the end of the table
+     * first.
+     */
+    STATIC_ASSERT(ENTRY_STUB_SIZE >= sizeof(DYNAMIC_ENTRY_TEMPLATE));
+    if (slot >= MAPI_TABLE_NUM_STATIC) {
+        memcpy(writeEntry, DYNAMIC_ENTRY_TEMPLATE, sizeof(DYNAMIC_ENTRY_TEMPLATE));
+        *((unsigned int *) &writeEntry[TLS_ADDR_OFFSET]) = (unsigned int) tls_addr;
+        *((unsigned int *) &writeEntry[DYNAMIC_BLOCK_OFFSET]) =
+            (unsigned int) (MAPI_TABLE_NUM_STATIC * sizeof(mapi_func));
+        *((unsigned int *) &writeEntry[DYNAMIC_SLOT_OFFSET]) =
+            (unsigned int) ((slot - MAPI_TABLE_NUM_STATIC) * sizeof(mapi_func));
+        return;
+    }
+#endif
+
     memcpy(writeEntry, ENTRY_TEMPLATE, sizeof(ENTRY_TEMPLATE));
     *((unsigned int *) &writeEntry[TLS_ADDR_OFFSET]) = (unsigned int) tls_addr;
     *((unsigned int *) &writeEntry[SLOT_OFFSET]) = (unsigned int) (slot * sizeof(mapi_func));
@@ -0,0 +1,141 @@
+/*
+ * Mesa 3-D graphics library
+ *
+ * Copyright (C) 2010 LunarG Inc.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ * Authors:
+ *    Chia-I Wu <olv@lunarg.com>
+ */
+
+
+/**
+ * \file
+ *
+ * Dispatch stubs for x86-64 that use a TLS descriptor to find the current
+ * dispatch table.
+ *
+ * Unlike the initial-exec TLS stubs in entry_x86_64_tls.c, this doesn't need
+ * any static TLS space, so libGLdispatch can still be loaded with dlopen.
+ * Unlike the TSD stubs in entry_x86_64_tsd.c, the TLS descriptor call
+ * only clobbers %rax, so the stubs don't have to save and restore the
+ * function arguments.
+ *
+ * This file, and anything else that refers to _glapi_tls_Current, must be
+ * built with -mtls-dialect=gnu2.
+ */
+
+#include "entry.h"
+#include "entry_common.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+
+#include "utils_misc.h"
+#include "u_macros.h"
+#include "glapi.h"
+#include "glvnd/GLdispatchABI.h"
+
+#if defined(__ILP32__)
+#error "The TLS descriptor stubs don't support x32"
+#endif
+
+#define ENTRY_STUB_SIZE 32
+
+__asm__(".section wtext,\"ax\",@progbits\n");
+__asm__(".balign 4096\n"
+       ".globl public_entry_start\n"
+       ".hidden public_entry_start\n"
+        "public_entry_start:");
+
+#define STUB_ASM_ENTRY(func)                             \
+   ".globl " func "\n"                                   \
+   ".type " func ", @function\n"                         \
+   ".balign " U_STRINGIFY(ENTRY_STUB_SIZE) "\n" \
+   func ":"
+
+/*
+ * The TLS descriptor call expects the stack to be aligned the same way as for
+ * a normal function call, so we have to adjust %rsp around it.
+ */
+#define STUB_ASM_CODE(slot)                                 \
+   "subq $8, %rsp\n\t"                                      \
+   "leaq _glapi_tls_Current@TLSDESC(%rip), %rax\n\t"        \
+   "call *_glapi_tls_Current@TLSCALL(%rax)\n\t"             \
+   "addq $8, %rsp\n\t"                                      \
+   "movq %fs:(%rax), %r11\n\t"                              \
+   "jmp *(8 * " slot ")(%r11)"
+
+#define MAPI_TMP_STUB_ASM_GCC
+#include "mapi_tmp.h"
+
+__asm__(".balign 4096\n"
+       ".globl public_entry_end\n"
+       ".hidden public_entry_end\n"
+        "public_entry_end:");
+
+__asm__(".text\n");
+
+/*
+ * The generated stubs can't use a TLS descriptor directly, since that needs a
+ * relocation. Instead, they call this function, which returns the current
+ * dispatch table in %rax, and doesn't modify any other registers.
+ */
+__asm__(".balign 16\n"
+        "x86_64_current_table_tlsdesc:\n\t"
+        "subq $8, %rsp\n\t"
+        "leaq _glapi_tls_Current@TLSDESC(%rip), %rax\n\t"
+        "call *_glapi_tls_Current@TLSCALL(%rax)\n\t"
+        "addq $8, %rsp\n\t"
+        "movq %fs:(%rax), %rax\n\t"
+        "ret");
+
+extern char x86_64_current_table_tlsdesc[];
+
+const int entry_type = __GLDISPATCH_STUB_X86_64;
+const int entry_stub_size = ENTRY_STUB_SIZE;
+
+static const unsigned char ENTRY_TEMPLATE[] = {
+    0x48, 0x83, 0xec, 0x08,             // subq $8, %rsp
+    0x48, 0xb8, 0x00, 0x00, 0x00, 0x00, // movabs x86_64_current_table_tlsdesc, %rax
+    0x00, 0x00, 0x00, 0x00,
+    0xff, 0xd0,                         // call *%rax
+    0x48, 0x83, 0xc4, 0x08,             // addq $8, %rsp
+    0xff, 0xa0, 0x34, 0x12, 0x00, 0x00, // jmp *0x1234(%rax)
+};
+
+static const unsigned int HELPER_ADDR_OFFSET = 6;
+static const unsigned int SLOT_OFFSET = 22;
+
+void entry_generate_default_code(char *entry, int slot)
+{
+    char *writeEntry = u_execmem_get_writable(entry);
+
+    STATIC_ASSERT(ENTRY_STUB_SIZE >= sizeof(ENTRY_TEMPLATE));
+
+    assert(slot >= 0);
+
+    memcpy(writeEntry, ENTRY_TEMPLATE, sizeof(ENTRY_TEMPLATE));
+    *((uintptr_t *) &writeEntry[HELPER_ADDR_OFFSET]) = (uintptr_t) x86_64_current_table_tlsdesc;
+    *((unsigned int *) &writeEntry[SLOT_OFFSET]) = (unsigned int) (slot * sizeof(mapi_func));
+}
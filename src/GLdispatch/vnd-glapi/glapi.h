@@ -83,12 +83,22 @@ enum {
 
 #if defined (GLDISPATCH_USE_TLS)
 
+/*
+ * The TLS descriptor stubs use the default TLS model, so that libGLdispatch
+ * doesn't need any static TLS space.
+ */
+#if defined (GLDISPATCH_USE_TLSDESC)
+#define _GLAPI_TLS_MODEL
+#else
+#define _GLAPI_TLS_MODEL __attribute__((tls_model("initial-exec")))
+#endif
+
 /**
  * A pointer to each thread's dispatch table.
  */
 _GLAPI_EXPORT extern const __thread void *
     _glapi_tls_Current[GLAPI_NUM_CURRENT_ENTRIES]
-    __attribute__((tls_model("initial-exec")));
+    _GLAPI_TLS_MODEL;
 
 #endif /* defined (GLDISPATCH_USE_TLS) */
 
@@ -145,6 +155,45 @@ _glapi_get_current(void);
 unsigned int
 _glapi_get_dispatch_table_size(void);
 
+/**
+ * Returns the number of bytes to allocate for a dispatch table.
+ *
+ * With sparse tables (GLDISPATCH_SPARSE_TABLES), this only covers the static
+ * slots, and the dynamic slots are allocated separately by
+ * \c _glapi_reserve_table_slots. Otherwise, this is enough for
+ * \c _glapi_get_dispatch_table_size() slots.
+ *
+ * The memory for a new table must be zero-filled.
+ */
+size_t
+_glapi_get_dispatch_table_bytes(void);
+
+/**
+ * Makes sure that a dispatch table has room for the first \p count slots.
+ *
+ * With sparse tables, this allocates the block for the dynamic slots the
+ * first time that \p count includes one. If that fails, then the table's
+ * dynamic slots are left pointing to no-op functions.
+ *
+ * \return Non-zero on success, or zero on failure.
+ */
+int
+_glapi_reserve_table_slots(struct _glapi_table *table, int count);
+
+/**
+ * Returns the address of \p slot in a dispatch table. The slot must be
+ * covered by an earlier call to \c _glapi_reserve_table_slots.
+ */
+void **
+_glapi_get_table_slot(struct _glapi_table *table, int slot);
+
+/**
+ * Frees anything that \c _glapi_reserve_table_slots allocated for a table.
+ * This must be called before freeing the table itself.
+ */
+void
+_glapi_release_table_slots(struct _glapi_table *table);
+
 
 int
 _glapi_get_proc_offset(const char *funcName);
@@ -164,14 +213,59 @@ _glapi_get_proc_name(unsigned int offset);
  */
 int _glapi_get_stub_count(void);
 
+/**
+ * A callback to look up the real function for a dispatch table slot.
+ *
+ * \see _glapi_get_lazy_resolver
+ */
+typedef _glapi_proc (*_glapi_resolve_callback)(int slot);
+
+/**
+ * Sets the callback that the lazy resolver stubs use to look up the real
+ * function for a slot.
+ */
+void _glapi_set_resolve_callback(_glapi_resolve_callback callback);
+
+/**
+ * Returns a stub function that can be stored in a dispatch table instead of
+ * the real function for \p slot.
+ *
+ * When the stub is called, it calls the function set with
+ * \c _glapi_set_resolve_callback to look up the real function, and then
+ * calls that function.
+ *
+ * This works for dynamic slots as well, even before a stub has been generated
+ * for that slot.
+ *
+ * Returns NULL if no resolve callback is set, or if the entrypoint type
+ * doesn't support lazy resolving.
+ */
+_glapi_proc _glapi_get_lazy_resolver(int slot);
+
+/**
+ * Sets the callback that the call counting stubs use. The callback is
+ * responsible for counting the call and returning the function to call.
+ */
+void _glapi_set_count_callback(_glapi_resolve_callback callback);
+
+/**
+ * Returns a stub function that calls the function set with
+ * \c _glapi_set_count_callback, and then calls the function that it returns.
+ *
+ * Returns NULL if no count callback is set, or if the entrypoint type doesn't
+ * support call counting.
+ */
+_glapi_proc _glapi_get_count_thunk(int slot);
+
 /**
  * Functions used for patching entrypoints. These functions are exported from
  * an entrypoint library such as libGL.so or libOpenGL.so, and used in
  * libGLdispatch.
  *
- * \note The \c startPatch, \c finishPatch, and \c abortPatch functions are
- * currently unused, but will be used after some changes to
- * __GLdispatchPatchCallbacks are finished.
+ * When libGLdispatch switches from one vendor's patches to another's, it
+ * doesn't call \c restoreFuncs first. Instead, the stubs keep track of which
+ * functions were patched, and \c finishPatch and \c abortPatch restore
+ * anything that the previous vendor patched and the new vendor didn't.
  */
 typedef struct __GLdispatchStubPatchCallbacksRec {
     /**
@@ -190,6 +284,10 @@ typedef struct __GLdispatchStubPatchCallbacksRec {
     /**
      * Finishes any patching. This is called after \c startPatch if patching
      * is successful.
+     *
+     * Any functions that were patched before \c startPatch, but that weren't
+     * returned from \c getPatchOffset since then, are restored to their
+     * normal behavior.
      */
     void (* finishPatch) (void);
 
@@ -206,6 +304,9 @@ typedef struct __GLdispatchStubPatchCallbacksRec {
      * Called by libGLdispatch to restore each entrypoint to its normal,
      * unpatched behavior.
      *
+     * Only the functions that were returned from \c getPatchOffset need to
+     * be restored.
+     *
      * \return GL_TRUE on success, GL_FALSE on failure.
      */
     GLboolean (* restoreFuncs) (void);
@@ -229,6 +330,33 @@ typedef struct __GLdispatchStubPatchCallbacksRec {
      */
     int (* getStubSize) (void);
 
+    /**
+     * Starts patching while other threads might be calling the entrypoints.
+     *
+     * This works like \c startPatch, except that \c getPatchOffset returns
+     * a separate trampoline for each function, and \c finishPatch then
+     * switches each entrypoint over to its trampoline with a single atomic
+     * store. \c abortPatch leaves the entrypoints untouched.
+     *
+     * This fails if any entrypoints are still patched, or if the stubs don't
+     * support live patching.
+     *
+     * \return GL_TRUE on success, GL_FALSE on failure.
+     */
+    GLboolean (* startPatchLive) (void);
+
+    /**
+     * Redirects each entrypoint to jump straight to the function for its
+     * slot in \p table, using the same atomic stores as \c startPatchLive.
+     *
+     * This fails if any entrypoints are patched. \c restoreFuncs undoes it,
+     * and that's safe even while other threads are calling the entrypoints.
+     *
+     * \param table The dispatch table to take the functions from.
+     * \return GL_TRUE if any entrypoints were redirected.
+     */
+    GLboolean (* redirectFuncs) (const void * const *table);
+
 } __GLdispatchStubPatchCallbacks;
 
 /*!
@@ -27,9 +27,11 @@
  */
 
 #include <string.h>
+#include <assert.h>
+#include <sys/mman.h>
 #include "glapi.h"
 #include "u_current.h"
-#include "table.h" /* for MAPI_TABLE_NUM_SLOTS */
+#include "table.h"
 #include "stub.h"
 
 /*
@@ -83,6 +85,72 @@ _glapi_get_dispatch_table_size(void)
    return MAPI_TABLE_NUM_SLOTS;
 }
 
+size_t
+_glapi_get_dispatch_table_bytes(void)
+{
+   return MAPI_TABLE_SIZE;
+}
+
+int
+_glapi_reserve_table_slots(struct _glapi_table *table, int count)
+{
+#if defined(GLDISPATCH_SPARSE_TABLES)
+   mapi_func *funcs = (mapi_func *) table;
+   void *block;
+
+   if (count <= MAPI_TABLE_NUM_STATIC) {
+      return 1;
+   }
+   if (funcs[MAPI_TABLE_NUM_STATIC] != NULL
+         && funcs[MAPI_TABLE_NUM_STATIC] != (mapi_func) table_noop_dynamic) {
+      return 1;
+   }
+
+   // Like the tables themselves, use an anonymous mapping so that only the
+   // pages for the slots that actually get filled in take up any memory.
+   block = mmap(NULL, MAPI_TABLE_DYNAMIC_SIZE, PROT_READ | PROT_WRITE,
+         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (block == MAP_FAILED) {
+      funcs[MAPI_TABLE_NUM_STATIC] = (mapi_func) table_noop_dynamic;
+      return 0;
+   }
+
+   // The table might be current, and if an earlier call failed, then its
+   // existing dynamic slots point to no-op functions. The caller only fills
+   // in the new slots, so copy the no-op functions for the rest.
+   memcpy(block, table_noop_dynamic,
+         (count - MAPI_TABLE_NUM_STATIC) * sizeof(mapi_func));
+
+   // Another thread could be calling through this table, so make sure the
+   // no-op functions are visible before the block is.
+   __sync_synchronize();
+   funcs[MAPI_TABLE_NUM_STATIC] = (mapi_func) block;
+#endif
+   return 1;
+}
+
+void **
+_glapi_get_table_slot(struct _glapi_table *table, int slot)
+{
+   void **ptr = (void **) table_get_slot(table, slot);
+   assert(ptr != NULL);
+   return ptr;
+}
+
+void
+_glapi_release_table_slots(struct _glapi_table *table)
+{
+#if defined(GLDISPATCH_SPARSE_TABLES)
+   mapi_func *funcs = (mapi_func *) table;
+
+   if (funcs[MAPI_TABLE_NUM_STATIC] != NULL
+         && funcs[MAPI_TABLE_NUM_STATIC] != (mapi_func) table_noop_dynamic) {
+      munmap((void *) funcs[MAPI_TABLE_NUM_STATIC], MAPI_TABLE_DYNAMIC_SIZE);
+   }
+   funcs[MAPI_TABLE_NUM_STATIC] = NULL;
+#endif
+}
+
 static const struct mapi_stub *
 _glapi_get_stub(const char *name, int generate)
 {
@@ -136,3 +204,45 @@ int _glapi_get_stub_count(void)
     return stub_get_count();
 }
 
+static _glapi_resolve_callback resolveCallback = NULL;
+
+void _glapi_set_resolve_callback(_glapi_resolve_callback callback)
+{
+    resolveCallback = callback;
+}
+
+_glapi_proc _glapi_get_lazy_resolver(int slot)
+{
+    if (resolveCallback == NULL) {
+        return NULL;
+    }
+    return (_glapi_proc) entry_get_lazy_resolver(slot);
+}
+
+mapi_func entry_resolve_slot(int slot)
+{
+    assert(resolveCallback != NULL);
+    return (mapi_func) resolveCallback(slot);
+}
+
+static _glapi_resolve_callback countCallback = NULL;
+
+void _glapi_set_count_callback(_glapi_resolve_callback callback)
+{
+    countCallback = callback;
+}
+
+_glapi_proc _glapi_get_count_thunk(int slot)
+{
+    if (countCallback == NULL) {
+        return NULL;
+    }
+    return (_glapi_proc) entry_get_count_thunk(slot);
+}
+
+mapi_func entry_count_slot(int slot)
+{
+    assert(countCallback != NULL);
+    return (mapi_func) countCallback(slot);
+}
+
@@ -26,6 +26,7 @@
  */
 
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <assert.h>
 
@@ -43,58 +44,116 @@
 
 struct mapi_stub {
     /*!
-     * The name of the stub function.
+     * For a static stub, the offset of its name in public_stub_names. Using
+     * an offset instead of a pointer means that public_stubs doesn't need any
+     * relocations.
      */
-    const char *name;
+    uint32_t nameOffset;
 
     int slot;
     mapi_func addr;
 
     /**
      * A buffer to store the name of the function. This is only used for
-     * dynamic stubs. For static stubs, mapi_stub::name is a static
-     * string and mapi_stub::nameBuffer is NULL.
+     * dynamic stubs. For static stubs, this is NULL.
      */
     char *nameBuffer;
 };
 
-/* define public_stubs */
+/*
+ * define public_stub_names, public_stubs, public_stub_hash_seeds,
+ * public_stub_hash_slots, and public_stub_layout
+ */
 #define MAPI_TMP_PUBLIC_STUBS
 #include "mapi_tmp.h"
 
-static int
-stub_compare(const void *key, const void *elem)
+/**
+ * Hashes a function name. This must match _stub_hash in
+ * gen_gldispatch_mapi.py.
+ */
+static uint32_t
+stub_hash(const char *name)
 {
-   const char *name = (const char *) key;
-   const struct mapi_stub *stub = (const struct mapi_stub *) elem;
-   const char *stub_name;
-
-   // Skip the "gl" prefix.
-   stub_name = stub->name + 2;
+    uint32_t h = 2166136261u;
+    for (; *name != '\0'; name++) {
+        h ^= (unsigned char) *name;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-   return strcmp(name, stub_name);
+/**
+ * Mixes a hash value with a seed. This must match _stub_hash_mix in
+ * gen_gldispatch_mapi.py.
+ */
+static uint32_t
+stub_hash_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
 }
 
 /**
  * Return the public stub with the given name.
+ *
+ * The generated header contains a minimal perfect hash for the public stubs:
+ * The name's hash selects a seed, and the hash mixed with that seed selects
+ * the only stub that the name could match.
  */
 const struct mapi_stub *
 stub_find_public(const char *name)
 {
+    const struct mapi_stub *stub;
+    uint32_t h, seed;
+
     // All of the function names start with "gl", so skip that prefix when
-    // comparing names.
+    // hashing and comparing names.
     if (name[0] == 'g' && name[1] == 'l') {
         name += 2;
     }
 
-   return (const struct mapi_stub *) bsearch(name, public_stubs,
-         ARRAY_SIZE(public_stubs), sizeof(public_stubs[0]), stub_compare);
+    h = stub_hash(name);
+    seed = public_stub_hash_seeds[h % ARRAY_SIZE(public_stub_hash_seeds)];
+    stub = &public_stubs[public_stub_hash_slots[stub_hash_mix(h ^ seed)
+            % ARRAY_SIZE(public_stubs)]];
+
+    if (strcmp(public_stub_names + stub->nameOffset + 2, name) == 0) {
+        return stub;
+    } else {
+        return NULL;
+    }
 }
 
 #if !defined(STATIC_DISPATCH_ONLY)
 static struct mapi_stub dynamic_stubs[MAPI_TABLE_NUM_DYNAMIC];
 static int num_dynamic_stubs;
 
+/**
+ * The number of buckets in dynamic_stub_index. This must be a power of two,
+ * and it's at least twice the number of dynamic stubs so that the index never
+ * gets more than half full.
+ */
+#define DYNAMIC_STUB_INDEX_SIZE 32768
+
+/**
+ * An open-addressing hash index for dynamic_stubs, using linear probing.
+ *
+ * Each bucket holds an index into dynamic_stubs plus one, or zero if the
+ * bucket is empty. Dynamic stubs are never removed individually, so the only
+ * time a bucket is cleared is in stub_cleanup_dynamic.
+ */
+static uint16_t dynamic_stub_index[DYNAMIC_STUB_INDEX_SIZE];
+
+#if DYNAMIC_STUB_INDEX_SIZE < 2 * MAPI_TABLE_NUM_DYNAMIC
+#error "DYNAMIC_STUB_INDEX_SIZE is too small"
+#endif
+
+static void stub_patch_forget_dynamic(void);
+
 void stub_cleanup_dynamic(void)
 {
     int i;
@@ -106,15 +165,40 @@ void stub_cleanup_dynamic(void)
         stub->nameBuffer = NULL;
     }
 
+    stub_patch_forget_dynamic();
+
     num_dynamic_stubs = 0;
+    memset(dynamic_stub_index, 0, sizeof(dynamic_stub_index));
     u_execmem_free();
 }
 
+/**
+ * Looks up a name in dynamic_stub_index.
+ *
+ * \return The bucket that holds the stub with that name, or the empty bucket
+ * where it would go.
+ */
+static uint16_t *
+stub_find_dynamic_bucket(const char *name)
+{
+   uint32_t h = stub_hash(name);
+
+   while (1) {
+      uint16_t *bucket = &dynamic_stub_index[h & (DYNAMIC_STUB_INDEX_SIZE - 1)];
+      if (*bucket == 0 || strcmp(name, dynamic_stubs[*bucket - 1].nameBuffer) == 0) {
+         return bucket;
+      }
+      h++;
+   }
+}
+
 /**
  * Add a dynamic stub.
+ *
+ * \param bucket The empty bucket in dynamic_stub_index for the new stub.
  */
 static struct mapi_stub *
-stub_add_dynamic(const char *name)
+stub_add_dynamic(const char *name, uint16_t *bucket)
 {
    struct mapi_stub *stub;
    int idx;
@@ -143,9 +227,10 @@ stub_add_dynamic(const char *name)
       stub->nameBuffer = NULL;
       return NULL;
    }
-   stub->name = stub->nameBuffer;
+   table_init_noop_slot(stub->slot);
 
    num_dynamic_stubs = idx + 1;
+   *bucket = (uint16_t) (idx + 1);
 
    return stub;
 }
@@ -158,22 +243,19 @@ struct mapi_stub *
 stub_find_dynamic(const char *name, int generate)
 {
    struct mapi_stub *stub = NULL;
-   int count, i;
+   uint16_t *bucket;
    
    if (generate)
       assert(!stub_find_public(name));
 
-   count = num_dynamic_stubs;
-   for (i = 0; i < count; i++) {
-      if (strcmp(name, dynamic_stubs[i].name) == 0) {
-         stub = &dynamic_stubs[i];
-         break;
-      }
+   bucket = stub_find_dynamic_bucket(name);
+   if (*bucket != 0) {
+      stub = &dynamic_stubs[*bucket - 1];
    }
 
    /* generate a dynamic stub */
    if (generate && !stub)
-         stub = stub_add_dynamic(name);
+         stub = stub_add_dynamic(name, bucket);
 
    return stub;
 }
@@ -198,7 +280,10 @@ stub_find_by_slot(int slot)
 const char *
 stub_get_name(const struct mapi_stub *stub)
 {
-   return stub->name;
+   if (stub->nameBuffer != NULL) {
+      return stub->nameBuffer;
+   }
+   return public_stub_names + stub->nameOffset;
 }
 
 int stub_get_count(void)
@@ -231,7 +316,7 @@ stub_get_addr(const struct mapi_stub *stub)
    else
    {
       int index = stub - public_stubs;
-      return entry_get_public(index);
+      return entry_get_public(public_stub_layout[index]);
    }
 }
 
@@ -240,6 +325,150 @@ static int stub_allow_override(void)
     return !!entry_stub_size;
 }
 
+/*
+ * The stubs that a vendor library might have written to.
+ *
+ * Any stub that we return from stubGetPatchOffset goes into patched_stubs,
+ * so that restoring the stubs or switching to a different vendor only has to
+ * touch the stubs that were actually patched, instead of every stub.
+ *
+ * stub_patch_state holds one of the STUB_PATCH_* values for each stub, using
+ * the index from stub_patch_index.
+ */
+enum {
+    /// The stub isn't in patched_stubs.
+    STUB_PATCH_NONE = 0,
+
+    /// The stub was patched by a previous patch.
+    STUB_PATCH_OLD,
+
+    /// The stub was returned from stubGetPatchOffset during the current
+    /// patch.
+    STUB_PATCH_NEW,
+};
+
+#if !defined(STATIC_DISPATCH_ONLY)
+#define STUB_PATCH_COUNT (ARRAY_SIZE(public_stubs) + MAPI_TABLE_NUM_DYNAMIC)
+#else
+#define STUB_PATCH_COUNT ARRAY_SIZE(public_stubs)
+#endif
+
+static unsigned char stub_patch_state[STUB_PATCH_COUNT];
+static const struct mapi_stub **patched_stubs = NULL;
+static int num_patched_stubs = 0;
+static int max_patched_stubs = 0;
+
+/*
+ * Set between stubStartPatchLive and stubFinishPatch or stubAbortPatch.
+ */
+static GLboolean stub_patch_live = GL_FALSE;
+
+/*
+ * Set if the stubs in patched_stubs were patched with stubStartPatchLive, so
+ * each one is redirected to a trampoline instead of being overwritten.
+ */
+static GLboolean stub_patch_redirected = GL_FALSE;
+
+static unsigned char *stub_patch_state_ptr(const struct mapi_stub *stub)
+{
+    if (stub->addr == NULL) {
+        return &stub_patch_state[stub - public_stubs];
+    }
+#if !defined(STATIC_DISPATCH_ONLY)
+    return &stub_patch_state[ARRAY_SIZE(public_stubs) + (stub - dynamic_stubs)];
+#else
+    assert(!"Invalid stub");
+    return NULL;
+#endif
+}
+
+/**
+ * Adds a stub to patched_stubs if it's not already there, and marks it as
+ * part of the current patch.
+ */
+static GLboolean stub_patch_track(const struct mapi_stub *stub)
+{
+    unsigned char *state = stub_patch_state_ptr(stub);
+
+    if (*state == STUB_PATCH_NONE) {
+        if (num_patched_stubs >= max_patched_stubs) {
+            int newMax = (max_patched_stubs > 0 ? max_patched_stubs * 2 : 256);
+            const struct mapi_stub **newList = realloc(patched_stubs,
+                    newMax * sizeof(const struct mapi_stub *));
+            if (newList == NULL) {
+                return GL_FALSE;
+            }
+            patched_stubs = newList;
+            max_patched_stubs = newMax;
+        }
+        patched_stubs[num_patched_stubs++] = stub;
+    }
+    *state = STUB_PATCH_NEW;
+    return GL_TRUE;
+}
+
+static int stub_patch_slot(const struct mapi_stub *stub)
+{
+    return (stub->slot == -1) ? MAPI_LAST_SLOT : stub->slot;
+}
+
+static void stub_patch_restore(const struct mapi_stub *stub)
+{
+    if (stub_patch_redirected) {
+        entry_patch_unredirect(stub_get_addr(stub), stub_patch_slot(stub));
+    } else {
+        entry_generate_default_code((char *)stub_get_addr(stub),
+                stub_patch_slot(stub));
+    }
+}
+
+/**
+ * Called after any restore or patch that leaves none of the stubs redirected.
+ */
+static void stub_patch_clear_redirects(void)
+{
+    if (stub_patch_redirected) {
+        entry_patch_sync();
+        stub_patch_redirected = GL_FALSE;
+    }
+    entry_patch_free_trampolines();
+}
+
+/**
+ * Makes every stub in patched_stubs writable.
+ */
+static GLboolean stub_patch_unprotect_listed(void)
+{
+    int i;
+
+    for (i = 0; i < num_patched_stubs; i++) {
+        entry_patch_add(stub_get_addr(patched_stubs[i]));
+    }
+    return entry_patch_unprotect() ? GL_TRUE : GL_FALSE;
+}
+
+#if !defined(STATIC_DISPATCH_ONLY)
+static void stub_patch_forget_dynamic(void)
+{
+    int i, count = 0;
+
+    for (i = 0; i < num_patched_stubs; i++) {
+        if (patched_stubs[i]->addr == NULL) {
+            patched_stubs[count++] = patched_stubs[i];
+        } else {
+            *stub_patch_state_ptr(patched_stubs[i]) = STUB_PATCH_NONE;
+        }
+    }
+    num_patched_stubs = count;
+
+    if (num_patched_stubs == 0) {
+        free(patched_stubs);
+        patched_stubs = NULL;
+        max_patched_stubs = 0;
+    }
+}
+#endif // !defined(STATIC_DISPATCH_ONLY)
+
 static GLboolean stubStartPatch(void)
 {
     if (!stub_allow_override()) {
@@ -250,55 +479,196 @@ static GLboolean stubStartPatch(void)
         return GL_FALSE;
     }
 
+    // When we switch between vendors, the new vendor will usually patch the
+    // same stubs as the old one, so make all of those writable up front
+    // instead of one page at a time. That also ensures that stubFinishPatch
+    // can restore any of them that the new vendor doesn't overwrite.
+    if (!stub_patch_unprotect_listed()) {
+        entry_patch_finish();
+        return GL_FALSE;
+    }
+
     return GL_TRUE;
 }
 
+static GLboolean stubStartPatchLive(void)
+{
+    if (!stub_allow_override()) {
+        return GL_FALSE;
+    }
+
+    // Other threads could be running any of the stubs that are already
+    // patched, so only start from the unpatched stubs.
+    if (num_patched_stubs != 0) {
+        return GL_FALSE;
+    }
+
+    if (!entry_patch_live_start()) {
+        return GL_FALSE;
+    }
+
+    stub_patch_live = GL_TRUE;
+    return GL_TRUE;
+}
+
+static void stubFinishPatchLive(void)
+{
+    int i;
+
+    // Make sure every thread sees the trampolines before any of them can
+    // jump to one, and then make sure every thread sees the jumps.
+    entry_patch_sync();
+    for (i = 0; i < num_patched_stubs; i++) {
+        const struct mapi_stub *stub = patched_stubs[i];
+        entry_patch_redirect(stub_get_addr(stub), stub_patch_slot(stub));
+        *stub_patch_state_ptr(stub) = STUB_PATCH_OLD;
+    }
+    entry_patch_sync();
+
+    stub_patch_live = GL_FALSE;
+    stub_patch_redirected = GL_TRUE;
+    entry_patch_finish();
+}
+
 static void stubFinishPatch(void)
 {
+    int i, count = 0;
+
+    if (stub_patch_live) {
+        stubFinishPatchLive();
+        return;
+    }
+
+    // Restore any stubs that the previous vendor patched but the current one
+    // didn't, and leave everything else alone.
+    for (i = 0; i < num_patched_stubs; i++) {
+        const struct mapi_stub *stub = patched_stubs[i];
+        unsigned char *state = stub_patch_state_ptr(stub);
+
+        if (*state == STUB_PATCH_NEW) {
+            *state = STUB_PATCH_OLD;
+            patched_stubs[count++] = stub;
+        } else {
+            stub_patch_restore(stub);
+            *state = STUB_PATCH_NONE;
+        }
+    }
+    num_patched_stubs = count;
+
+    // Any stubs that were redirected have been either overwritten or
+    // restored by now.
+    stub_patch_clear_redirects();
+
     entry_patch_finish();
 }
 
+/**
+ * Restores every stub in patched_stubs. The caller must have already made
+ * them writable.
+ */
 static void stubRestoreFuncsInternal(void)
 {
-    int i, slot;
-    const struct mapi_stub *stub;
+    int i;
 
     assert(stub_allow_override());
 
-    for (stub = public_stubs, i = 0;
-         i < ARRAY_SIZE(public_stubs);
-         stub++, i++) {
-        slot = (stub->slot == -1) ? MAPI_LAST_SLOT : stub->slot;
-        entry_generate_default_code((char *)stub_get_addr(stub), slot);
-    }
-
-#if !defined(STATIC_DISPATCH_ONLY)
-    for (stub = dynamic_stubs, i = 0;
-         i < num_dynamic_stubs;
-         stub++, i++) {
-        slot = (stub->slot == -1) ? MAPI_LAST_SLOT : stub->slot;
-        entry_generate_default_code((char *)stub_get_addr(stub), slot);
+    for (i = 0; i < num_patched_stubs; i++) {
+        stub_patch_restore(patched_stubs[i]);
+        *stub_patch_state_ptr(patched_stubs[i]) = STUB_PATCH_NONE;
     }
-#endif // !defined(STATIC_DISPATCH_ONLY)
+    num_patched_stubs = 0;
+    stub_patch_clear_redirects();
 }
 
 static GLboolean stubRestoreFuncs(void)
 {
+    if (num_patched_stubs == 0) {
+        return GL_TRUE;
+    }
+
     if (entry_patch_start()) {
-        stubRestoreFuncsInternal();
+        if (stub_patch_unprotect_listed()) {
+            stubRestoreFuncsInternal();
+            entry_patch_finish();
+            return GL_TRUE;
+        }
         entry_patch_finish();
-        return GL_TRUE;
-    } else {
-        return GL_FALSE;
     }
+    return GL_FALSE;
 }
 
 static void stubAbortPatch(void)
 {
-    stubRestoreFuncsInternal();
+    if (stub_patch_live) {
+        int i;
+
+        // None of the stubs have been touched yet, so we only have to throw
+        // away the trampolines.
+        for (i = 0; i < num_patched_stubs; i++) {
+            *stub_patch_state_ptr(patched_stubs[i]) = STUB_PATCH_NONE;
+        }
+        num_patched_stubs = 0;
+        stub_patch_live = GL_FALSE;
+        entry_patch_free_trampolines();
+    } else {
+        stubRestoreFuncsInternal();
+    }
     entry_patch_finish();
 }
 
+/**
+ * Adds a stub to the list for stubRedirectFuncs if there's a function for it
+ * in \p table.
+ */
+static GLboolean stub_redirect_add(const struct mapi_stub *stub,
+        const void * const *table)
+{
+    mapi_func addr = stub_get_addr(stub);
+    mapi_func target;
+
+    if (stub->slot < 0 || addr == NULL) {
+        return GL_TRUE;
+    }
+    target = table_get_func((const struct _glapi_table *) table, stub->slot);
+    if (target == NULL) {
+        return GL_TRUE;
+    }
+    if (!entry_patch_set_target(addr, stub->slot, (const void *) target)) {
+        return GL_TRUE;
+    }
+    entry_patch_add(addr);
+    return stub_patch_track(stub);
+}
+
+static GLboolean stubRedirectFuncs(const void * const *table)
+{
+    GLboolean success = GL_TRUE;
+    size_t i;
+
+    if (!stubStartPatchLive()) {
+        return GL_FALSE;
+    }
+
+    for (i = 0; success && i < ARRAY_SIZE(public_stubs); i++) {
+        success = stub_redirect_add(&public_stubs[i], table);
+    }
+#if !defined(STATIC_DISPATCH_ONLY)
+    for (i = 0; success && i < (size_t) num_dynamic_stubs; i++) {
+        success = stub_redirect_add(&dynamic_stubs[i], table);
+    }
+#endif // !defined(STATIC_DISPATCH_ONLY)
+
+    // Always call entry_patch_unprotect, so that it clears the pending pages
+    // even if we're about to give up.
+    if (!entry_patch_unprotect() || !success || num_patched_stubs == 0) {
+        stubAbortPatch();
+        return GL_FALSE;
+    }
+
+    stubFinishPatchLive();
+    return GL_TRUE;
+}
+
 static GLboolean stubGetPatchOffset(const char *name, void **writePtr, const void **execPtr)
 {
     const struct mapi_stub *stub;
@@ -316,7 +686,21 @@ static GLboolean stubGetPatchOffset(const char *name, void **writePtr, const voi
     if (stub) {
         mapi_func addr = stub_get_addr(stub);
         if (addr != NULL) {
-            entry_get_patch_addresses(addr, &writeAddr, &execAddr);
+            // Make the stub writable, and then keep track of it so that we
+            // can restore it later.
+            entry_patch_add(addr);
+            if (!entry_patch_unprotect()) {
+                // Leave writeAddr and execAddr as NULL.
+            } else if (stub_patch_live) {
+                if (entry_patch_get_trampoline(addr, stub_patch_slot(stub),
+                            &writeAddr, &execAddr)
+                        && !stub_patch_track(stub)) {
+                    writeAddr = NULL;
+                    execAddr = NULL;
+                }
+            } else if (stub_patch_track(stub)) {
+                entry_get_patch_addresses(addr, &writeAddr, &execAddr);
+            }
         }
     }
 
@@ -349,6 +733,8 @@ static const __GLdispatchStubPatchCallbacks stubPatchCallbacks =
     stubGetPatchOffset, // getPatchOffset
     stubGetStubType,    // getStubType
     stubGetStubSize,    // getStubSize
+    stubStartPatchLive, // startPatchLive
+    stubRedirectFuncs,  // redirectFuncs
 };
 
 const __GLdispatchStubPatchCallbacks *stub_get_patch_callbacks(void)
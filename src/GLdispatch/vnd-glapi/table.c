@@ -48,3 +48,20 @@ noop_generic(void)
 #define MAPI_TMP_DEFINES
 #define MAPI_TMP_NOOP_ARRAY
 #include "mapi_tmp.h"
+
+#if defined(GLDISPATCH_SPARSE_TABLES)
+mapi_func table_noop_dynamic[MAPI_TABLE_NUM_DYNAMIC];
+#endif
+
+void
+table_init_noop_slot(int slot)
+{
+#if defined(GLDISPATCH_SPARSE_TABLES)
+   if (slot >= MAPI_TABLE_NUM_STATIC) {
+      table_noop_dynamic[slot - MAPI_TABLE_NUM_STATIC] = (mapi_func) noop_generic;
+      table_noop_array[MAPI_TABLE_NUM_STATIC] = (mapi_func) table_noop_dynamic;
+      return;
+   }
+#endif
+   table_noop_array[slot] = (mapi_func) noop_generic;
+}
@@ -36,9 +36,40 @@
 #include "mapi_tmp.h"
 
 #define MAPI_TABLE_NUM_SLOTS (MAPI_TABLE_NUM_STATIC + MAPI_TABLE_NUM_DYNAMIC)
-#define MAPI_TABLE_SIZE (MAPI_TABLE_NUM_SLOTS * sizeof(mapi_func))
 
-extern const mapi_func table_noop_array[];
+#if defined(GLDISPATCH_SPARSE_TABLES)
+
+/*
+ * With sparse tables, a dispatch table only holds the static slots, followed
+ * by a pointer to a separate block with the dynamic slots. That pointer is
+ * NULL until something allocates the block, which means that most tables
+ * never need any memory for the dynamic slots at all.
+ */
+#define MAPI_TABLE_NUM_ENTRIES (MAPI_TABLE_NUM_STATIC + 1)
+#define MAPI_TABLE_DYNAMIC_SIZE (MAPI_TABLE_NUM_DYNAMIC * sizeof(mapi_func))
+
+/**
+ * The dynamic slots for the no-op table. This is also used for any table
+ * where we couldn't allocate a block, so that calls to a dynamic stub still
+ * go somewhere.
+ */
+extern mapi_func table_noop_dynamic[];
+
+#else // defined(GLDISPATCH_SPARSE_TABLES)
+
+#define MAPI_TABLE_NUM_ENTRIES MAPI_TABLE_NUM_SLOTS
+
+#endif // defined(GLDISPATCH_SPARSE_TABLES)
+
+#define MAPI_TABLE_SIZE (MAPI_TABLE_NUM_ENTRIES * sizeof(mapi_func))
+
+extern mapi_func table_noop_array[];
+
+/**
+ * Fills in the no-op function for a dynamic slot. This must be called before
+ * returning a new dynamic stub.
+ */
+void table_init_noop_slot(int slot);
 
 /**
  * Get the no-op dispatch table.
@@ -49,14 +80,33 @@ table_get_noop(void)
    return (const struct _glapi_table *) table_noop_array;
 }
 
+/**
+ * Returns the address of a slot, or NULL if it's a dynamic slot and the
+ * table doesn't have a block for the dynamic slots yet.
+ */
+static INLINE mapi_func *
+table_get_slot(struct _glapi_table *tbl, int slot)
+{
+   mapi_func *funcs = (mapi_func *) tbl;
+#if defined(GLDISPATCH_SPARSE_TABLES)
+   if (slot >= MAPI_TABLE_NUM_STATIC) {
+      funcs = (mapi_func *) funcs[MAPI_TABLE_NUM_STATIC];
+      if (funcs == NULL) {
+         return NULL;
+      }
+      slot -= MAPI_TABLE_NUM_STATIC;
+   }
+#endif
+   return &funcs[slot];
+}
+
 /**
  * Set the function of a slot.
  */
 static INLINE void
 table_set_func(struct _glapi_table *tbl, int slot, mapi_func func)
 {
-   mapi_func *funcs = (mapi_func *) tbl;
-   funcs[slot] = func;
+   *table_get_slot(tbl, slot) = func;
 }
 
 /**
@@ -65,8 +115,8 @@ table_set_func(struct _glapi_table *tbl, int slot, mapi_func func)
 static INLINE mapi_func
 table_get_func(const struct _glapi_table *tbl, int slot)
 {
-   const mapi_func *funcs = (const mapi_func *) tbl;
-   return funcs[slot];
+   const mapi_func *func = table_get_slot((struct _glapi_table *) tbl, slot);
+   return (func != NULL ? *func : NULL);
 }
 
 #endif /* _TABLE_H_ */
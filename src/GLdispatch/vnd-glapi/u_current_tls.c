@@ -30,7 +30,7 @@
 #include "stub.h"
 
 __thread const void *_glapi_tls_Current[GLAPI_NUM_CURRENT_ENTRIES]
-    __attribute__((tls_model("initial-exec")))
+    _GLAPI_TLS_MODEL
     = {
         (void *) table_noop_array,
       };
@@ -41,8 +41,8 @@
 
 
 /*
- * Allocate 64 bytes for each stub so that they're large enough to hold the
- * x86-64 TSD stubs. The x86 TSD and x86-64 TLS stubs both take 32 bytes each.
+ * Each stub needs up to 64 bytes, which is enough to hold the x86-64 TSD
+ * stubs. The x86 TSD and x86-64 TLS stubs both take 32 bytes each.
  *
  * The x86-64 TSD stubs are larger than the others because it has to deal with
  * 64-bit addresses and preserving the function arguments.
@@ -57,15 +57,34 @@
  * parameters to the real function, we have to preserve them across the call to
  * u_current_get_internal. Pushing and popping those registers takes another 24
  * bytes.
+ *
+ * Most processes only generate a handful of stubs, so rather than mapping
+ * enough memory up front for every dynamic stub, we allocate the memory in
+ * chunks as we need it. The first chunk is EXEC_CHUNK_MIN_SIZE bytes, and
+ * each chunk after that is twice as large as the last one, up to
+ * EXEC_CHUNK_MAX_SIZE.
  */
-#define EXEC_MAP_SIZE (64*4096) // DISPATCH_FUNCTION_SIZE * MAPI_TABLE_NUM_DYNAMIC
+#define EXEC_CHUNK_MIN_SIZE (4*4096)
+#define EXEC_CHUNK_MAX_SIZE (64*4096)
 
-static glvnd_mutex_t exec_mutex = GLVND_MUTEX_INITIALIZER;
+/**
+ * One chunk of executable memory.
+ */
+struct exec_chunk {
+    struct exec_chunk *next;
+    unsigned char *exec_mem;
+    unsigned char *write_mem;
+    unsigned int size;
+    unsigned int head;
+};
 
-static unsigned int head = 0;
+static glvnd_mutex_t exec_mutex = GLVND_MUTEX_INITIALIZER;
 
-static unsigned char *exec_mem = NULL;
-static unsigned char *write_mem = NULL;
+/**
+ * The list of chunks, with the newest chunk first. New stubs are only ever
+ * allocated from the first chunk.
+ */
+static struct exec_chunk *exec_chunks = NULL;
 
 
 #if defined(__linux__) || defined(__OpenBSD__) || defined(_NetBSD__) || defined(__sun) || defined(__HAIKU__)
@@ -84,27 +103,21 @@ static unsigned char *write_mem = NULL;
  */
 
 static int
-init_map(void)
+map_chunk(struct exec_chunk *chunk)
 {
-    if (exec_mem == NULL) {
-        void *writePtr, *execPtr;
-        if (AllocExecPages(EXEC_MAP_SIZE, &writePtr, &execPtr) == 0) {
-            exec_mem = (unsigned char *) execPtr;
-            write_mem = (unsigned char *) writePtr;
-            head = 0;
-        }
+    void *writePtr, *execPtr;
+    if (AllocExecPages(chunk->size, &writePtr, &execPtr) != 0) {
+        return 0;
     }
-
-    return (exec_mem != NULL);
+    chunk->exec_mem = (unsigned char *) execPtr;
+    chunk->write_mem = (unsigned char *) writePtr;
+    return 1;
 }
 
-void u_execmem_free(void)
+static void
+unmap_chunk(struct exec_chunk *chunk)
 {
-    if (exec_mem != NULL) {
-        FreeExecPages(EXEC_MAP_SIZE, write_mem, exec_mem);
-        write_mem = NULL;
-        exec_mem = NULL;
-    }
+    FreeExecPages(chunk->size, chunk->write_mem, chunk->exec_mem);
 }
 
 #elif defined(_WIN32)
@@ -117,12 +130,18 @@ void u_execmem_free(void)
  */
 
 static int
-init_map(void)
+map_chunk(struct exec_chunk *chunk)
 {
-   exec_mem = VirtualAlloc(NULL, EXEC_MAP_SIZE, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
-   write_mem = exec_mem;
+   chunk->exec_mem = VirtualAlloc(NULL, chunk->size, MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+   chunk->write_mem = chunk->exec_mem;
 
-   return (exec_mem != NULL);
+   return (chunk->exec_mem != NULL);
+}
+
+static void
+unmap_chunk(struct exec_chunk *chunk)
+{
+   VirtualFree(chunk->exec_mem, 0, MEM_RELEASE);
 }
 
 
@@ -131,34 +150,94 @@ init_map(void)
 #include <stdlib.h>
 
 static int
-init_map(void)
+map_chunk(struct exec_chunk *chunk)
 {
-   exec_mem = malloc(EXEC_MAP_SIZE);
-   write_mem = exec_mem;
+   chunk->exec_mem = malloc(chunk->size);
+   chunk->write_mem = chunk->exec_mem;
+
+   return (chunk->exec_mem != NULL);
+}
 
-   return (exec_mem != NULL);
+static void
+unmap_chunk(struct exec_chunk *chunk)
+{
+   free(chunk->exec_mem);
 }
 
 
 #endif
 
+/**
+ * Adds a new chunk to the front of the list, with enough room for at least
+ * \p minSize bytes.
+ */
+static struct exec_chunk *
+add_chunk(unsigned int minSize)
+{
+   struct exec_chunk *chunk;
+   unsigned int size = EXEC_CHUNK_MIN_SIZE;
+
+   if (exec_chunks != NULL) {
+      size = exec_chunks->size * 2;
+      if (size > EXEC_CHUNK_MAX_SIZE) {
+         size = EXEC_CHUNK_MAX_SIZE;
+      }
+   }
+   while (size < minSize) {
+      size *= 2;
+   }
+
+   /* With huge pages, one chunk is usually enough for every stub. */
+   size = RoundUpToHugePages(size);
+
+   chunk = (struct exec_chunk *) malloc(sizeof(struct exec_chunk));
+   if (chunk == NULL) {
+      return NULL;
+   }
+
+   chunk->size = size;
+   chunk->head = 0;
+   if (!map_chunk(chunk)) {
+      free(chunk);
+      return NULL;
+   }
+
+   chunk->next = exec_chunks;
+   exec_chunks = chunk;
+   return chunk;
+}
+
+void u_execmem_free(void)
+{
+    __glvndPthreadFuncs.mutex_lock(&exec_mutex);
+    while (exec_chunks != NULL) {
+        struct exec_chunk *chunk = exec_chunks;
+        exec_chunks = chunk->next;
+        unmap_chunk(chunk);
+        free(chunk);
+    }
+    __glvndPthreadFuncs.mutex_unlock(&exec_mutex);
+}
+
 void *
 u_execmem_alloc(unsigned int size)
 {
+   struct exec_chunk *chunk;
    void *addr = NULL;
 
    __glvndPthreadFuncs.mutex_lock(&exec_mutex);
 
-   if (!init_map())
-      goto bail;
-
    /* free space check, assumes no integer overflow */
-   if (head + size > EXEC_MAP_SIZE)
-      goto bail;
+   chunk = exec_chunks;
+   if (chunk == NULL || chunk->head + size > chunk->size) {
+      chunk = add_chunk(size);
+      if (chunk == NULL)
+         goto bail;
+   }
 
    /* allocation, assumes proper addr and size alignement */
-   addr = exec_mem + head;
-   head += size;
+   addr = chunk->exec_mem + chunk->head;
+   chunk->head += size;
 
 bail:
    __glvndPthreadFuncs.mutex_unlock(&exec_mutex);
@@ -168,16 +247,20 @@ bail:
 
 void *u_execmem_get_writable(void *execPtr)
 {
-    // If execPtr is within the executable mapping, then return the same offset
-    // in the writable mapping.
-    if (((uintptr_t) execPtr) >= ((uintptr_t) exec_mem))
+    const struct exec_chunk *chunk;
+
+    // If execPtr is within one of the executable mappings, then return the
+    // same offset in the writable mapping.
+    for (chunk = exec_chunks; chunk != NULL; chunk = chunk->next)
     {
-        uintptr_t offset = ((uintptr_t) execPtr) - ((uintptr_t) exec_mem);
-        if (offset < EXEC_MAP_SIZE)
+        if (((uintptr_t) execPtr) >= ((uintptr_t) chunk->exec_mem))
         {
-            return (void *) (((uintptr_t) write_mem) + offset);
+            uintptr_t offset = ((uintptr_t) execPtr) - ((uintptr_t) chunk->exec_mem);
+            if (offset < chunk->size)
+            {
+                return (void *) (((uintptr_t) chunk->write_mem) + offset);
+            }
         }
     }
     return execPtr;
 }
-
@@ -30,7 +30,7 @@ import collections
 import re
 import xml.etree.cElementTree as etree
 
-MAPI_TABLE_NUM_DYNAMIC = 4096
+MAPI_TABLE_NUM_DYNAMIC = 16384
 
 _LIBRARY_FEATURE_NAMES = {
     # libGL and libGLdiapatch both include every function.
@@ -102,6 +102,32 @@ def getExportNamesFromRoots(target, roots):
                 names.add(commandElem.get("name"))
     return names
 
+def generateStringPool(decl, strings):
+    """
+    Generates a C array that holds every string in strings, one after the
+    other, each with its own terminating NUL character.
+
+    Storing an offset into that array for each string, instead of a pointer,
+    means that the dynamic linker doesn't have to apply a relocation for each
+    string when it loads the library.
+
+    decl is the declaration for the array, like "static const char names[]".
+
+    Returns a tuple of (text, offsets), where offsets[i] is the offset of
+    strings[i] within the array.
+    """
+    text = decl + " =\n"
+    offsets = []
+    offset = 0
+    for string in strings:
+        offsets.append(offset)
+        text += '    "%s\\0"\n' % (string,)
+        offset += len(string) + 1
+    if (len(strings) == 0):
+        text += '    ""\n'
+    text += ";\n"
+    return (text, offsets)
+
 class FunctionArg(collections.namedtuple("FunctionArg", "type name")):
     @property
     def dec(self):
@@ -116,13 +116,19 @@ def generateSource(functions):
             text += generateDispatchFunc(func, eglFunc)
             text += generateGuardEnd(func, eglFunc)
 
+    # The string pool has every name, even the ones that get left out by a
+    # guard, so that the offsets don't depend on which functions are defined.
     text += "\n"
-    text += "const char * const __EGL_DISPATCH_FUNC_NAMES[__EGL_DISPATCH_COUNT + 1] = {\n"
-    for (func, eglFunc) in functions:
+    (poolText, offsets) = genCommon.generateStringPool(
+            "const char __EGL_DISPATCH_FUNC_NAME_POOL[]",
+            [func.name for (func, eglFunc) in functions])
+    text += poolText
+    text += "const uint32_t __EGL_DISPATCH_FUNC_NAME_OFFSETS[__EGL_DISPATCH_COUNT + 1] = {\n"
+    for ((func, eglFunc), offset) in zip(functions, offsets):
         text += generateGuardBegin(func, eglFunc)
-        text += '    "' + func.name + '",\n'
+        text += "    %d, // %s\n" % (offset, func.name)
         text += generateGuardEnd(func, eglFunc)
-    text += "    NULL\n"
+    text += "    0\n"
     text += "};\n"
 
     text += "const __eglMustCastToProperFunctionPointerType __EGL_DISPATCH_FUNCS[__EGL_DISPATCH_COUNT + 1] = {\n"
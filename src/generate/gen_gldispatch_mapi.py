@@ -38,8 +38,13 @@ import xml.etree.cElementTree as etree
 import genCommon
 
 def _main():
-    target = sys.argv[1]
-    xmlFiles = sys.argv[2:]
+    args = sys.argv[1:]
+    profileFile = None
+    if (len(args) > 0 and args[0].startswith("--profile=")):
+        profileFile = args[0][len("--profile="):]
+        args = args[1:]
+    target = args[0]
+    xmlFiles = args[1:]
 
     roots = [ etree.parse(filename).getroot() for filename in xmlFiles ]
     allFunctions = genCommon.getFunctionsFromRoots(roots)
@@ -62,12 +67,52 @@ typedef void (APIENTRY  *GLDEBUGPROCKHR)(GLenum source,GLenum type,GLuint id,GLe
 #endif /* _GLAPI_TMP_H_ */
 """.lstrip("\n"))
 
+    hotNames = []
+    if (profileFile):
+        hotNames = _read_profile(profileFile)
+    layout = _get_stub_layout(functions, hotNames)
+
     print(generate_defines(functions))
     print(generate_table(functions, allFunctions))
     print(generate_noop_array(functions))
-    print(generate_public_stubs(functions))
-    print(generate_public_entries(functions))
-    print(generate_stub_asm_gcc(functions))
+    print(generate_public_stubs(functions, layout))
+    print(generate_public_entries(layout))
+    print(generate_stub_asm_gcc(layout))
+
+def _read_profile(filename):
+    """
+    Reads a list of hot function names, one per line. Blank lines and
+    anything after a '#' are ignored.
+    """
+    names = []
+    with open(filename, "r") as f:
+        for line in f:
+            line = line.split("#", 1)[0].strip()
+            if (len(line) > 0):
+                names.append(line)
+    return names
+
+def _get_stub_layout(functions, hotNames):
+    """
+    Returns the functions in the order that their stubs should be laid out.
+
+    The functions in hotNames come first, in the same order as hotNames,
+    followed by everything else in the normal order. Any names in hotNames
+    that aren't in this library are ignored.
+
+    This only changes where each stub is, not its slot number.
+    """
+    byName = dict((func.name, func) for func in functions)
+    layout = []
+    seen = set()
+    for name in hotNames:
+        if (name in byName and name not in seen):
+            layout.append(byName[name])
+            seen.add(name)
+    for func in functions:
+        if (func.name not in seen):
+            layout.append(func)
+    return layout
 
 def generate_defines(functions):
     text = r"""
@@ -108,32 +153,117 @@ def generate_noop_array(functions):
             text += "   return ({f.rt}) 0;\n".format(f=func)
         text += "}\n\n"
 
-    text += "const mapi_func table_noop_array[] = {\n"
+    # Only the static slots are filled in here. The entry for a dynamic slot
+    # gets filled in when the stub for that slot is generated, so the rest of
+    # the array doesn't need any relocations.
+    text += "mapi_func table_noop_array[MAPI_TABLE_NUM_ENTRIES] = {\n"
     for func in functions:
         text += "   (mapi_func) noop{f.basename},\n".format(f=func)
-    for i in range(genCommon.MAPI_TABLE_NUM_DYNAMIC - 1):
-        text += "   (mapi_func) noop_generic,\n"
-    text += "   (mapi_func) noop_generic\n"
     text += "};\n\n"
     text += "#else /* DEBUG */\n\n"
-    text += "const mapi_func table_noop_array[] = {\n"
-    for i in range(len(functions) + genCommon.MAPI_TABLE_NUM_DYNAMIC - 1):
+    text += "mapi_func table_noop_array[MAPI_TABLE_NUM_ENTRIES] = {\n"
+    for i in range(len(functions)):
         text += "   (mapi_func) noop_generic,\n"
-    text += "   (mapi_func) noop_generic\n"
-
     text += "};\n\n"
     text += "#endif /* DEBUG */\n"
     text += "#undef MAPI_TMP_NOOP_ARRAY\n"
     text += "#endif /* MAPI_TMP_NOOP_ARRAY */\n"
     return text
 
-def generate_public_stubs(functions):
+def _stub_hash(name):
+    """
+    Computes the same 32-bit FNV-1a hash as stub_hash() in stub.c.
+    """
+    h = 2166136261
+    for c in bytearray(name.encode("ascii")):
+        h ^= c
+        h = (h * 16777619) & 0xffffffff
+    return h
+
+def _stub_hash_mix(h):
+    """
+    Computes the same function as stub_hash_mix() in stub.c.
+    """
+    h ^= h >> 16
+    h = (h * 0x85ebca6b) & 0xffffffff
+    h ^= h >> 13
+    h = (h * 0xc2b2ae35) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+def _build_perfect_hash(names):
+    """
+    Builds a minimal perfect hash for a list of names, using the
+    hash-and-displace method.
+
+    Each name goes into a bucket based on its hash. Then, starting with the
+    largest buckets, we look for a seed for each bucket that puts every name
+    in that bucket into a free position.
+
+    Returns a tuple of (seeds, positions), where seeds has one entry per
+    bucket, and positions[p] is the index into names for position p.
+    """
+    count = len(names)
+    hashes = [_stub_hash(name) for name in names]
+    assert(len(set(hashes)) == count)
+
+    numBuckets = max(1, count // 4)
+    buckets = [[] for i in range(numBuckets)]
+    for (i, h) in enumerate(hashes):
+        buckets[h % numBuckets].append(i)
+
+    seeds = [0] * numBuckets
+    positions = [None] * count
+    for b in sorted(range(numBuckets), key=lambda b: -len(buckets[b])):
+        if (len(buckets[b]) == 0):
+            break
+        seed = 1
+        while True:
+            pos = [_stub_hash_mix(hashes[i] ^ seed) % count for i in buckets[b]]
+            if (len(set(pos)) == len(pos) and all(positions[p] is None for p in pos)):
+                break
+            seed += 1
+        seeds[b] = seed
+        for (i, p) in zip(buckets[b], pos):
+            positions[p] = i
+    return (seeds, positions)
+
+def generate_public_stubs(functions, layout):
     text = "#ifdef MAPI_TMP_PUBLIC_STUBS\n"
 
+    (poolText, offsets) = genCommon.generateStringPool(
+            "static const char public_stub_names[]",
+            [func.name for func in functions])
+    text += poolText
+    text += "\n"
     text += "static const struct mapi_stub public_stubs[] = {\n"
-    for func in functions:
-        text += "   { \"%s\", %d, NULL },\n" % (func.name, func.slot)
+    for (func, offset) in zip(functions, offsets):
+        text += "   { %d, %d, NULL },\n" % (offset, func.slot)
+    text += "};\n"
+
+    # Generate a perfect hash table for stub_find_public. The names are hashed
+    # without the "gl" prefix.
+    assert(all(func.name.startswith("gl") for func in functions))
+    (seeds, positions) = _build_perfect_hash([func.name[2:] for func in functions])
+    text += "\n"
+    text += "static const uint32_t public_stub_hash_seeds[] = {\n"
+    for i in range(0, len(seeds), 8):
+        text += "   " + " ".join("%d," % seed for seed in seeds[i:i+8]) + "\n"
+    text += "};\n"
+    text += "static const uint16_t public_stub_hash_slots[] = {\n"
+    for i in range(0, len(positions), 8):
+        text += "   " + " ".join("%d," % p for p in positions[i:i+8]) + "\n"
+    text += "};\n"
+
+    # The position of each stub in the entrypoint section, which is different
+    # from its index in public_stubs if we've got a profile.
+    positions = dict((func.name, i) for (i, func) in enumerate(layout))
+    text += "\n"
+    text += "static const uint16_t public_stub_layout[] = {\n"
+    for i in range(0, len(functions), 8):
+        text += "   " + " ".join("%d," % positions[func.name] for func in functions[i:i+8]) + "\n"
     text += "};\n"
+
     text += "#undef MAPI_TMP_PUBLIC_STUBS\n"
     text += "#endif /* MAPI_TMP_PUBLIC_STUBS */\n"
     return text
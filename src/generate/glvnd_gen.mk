@@ -16,7 +16,12 @@ glapi_gen_glx_deps := \
 glapi_gen_mapi_script := $(top_srcdir)/src/generate/gen_gldispatch_mapi.py
 glapi_gen_mapi_deps := \
 	$(glapi_gen_mapi_script) \
-	$(glapi_gen_gl_deps)
+	$(glapi_gen_gl_deps) \
+	$(GLDISPATCH_ENTRYPOINT_PROFILE)
+
+# If there's an entrypoint profile, then the entrypoints for the functions in
+# it are laid out first.
+glapi_gen_mapi_profile := $(if $(GLDISPATCH_ENTRYPOINT_PROFILE),--profile=$(GLDISPATCH_ENTRYPOINT_PROFILE))
 
 # glapi_gen_mapi:
 # Generates the header file that's used to define all of the public entrypoint
@@ -31,7 +36,7 @@ glapi_gen_mapi_deps := \
 define glapi_gen_mapi
 $(AM_V_at)$(MKDIR_P) $(@D)
 $(AM_V_GEN)$(PYTHON2) $(PYTHON_FLAGS) $(glapi_gen_mapi_script) \
-	$(1) $(glapi_gen_gl_xml) > $@
+	$(glapi_gen_mapi_profile) $(1) $(glapi_gen_gl_xml) > $@
 endef
 
 # glapi_gen_libopengl_exports:
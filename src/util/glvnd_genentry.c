@@ -157,6 +157,7 @@ static void SetDispatchFuncPointer(GLVNDGenEntrypoint *entry,
 static GLVNDGenEntrypoint entrypoints[GENERATED_ENTRYPOINT_MAX] = {};
 static uint8_t *entrypointBufferWrite = NULL;
 static uint8_t *entrypointBufferExec = NULL;
+static size_t entrypointBufferSize = 0;
 static int entrypointCount = 0;
 
 GLVNDentrypointStub glvndGenerateEntrypoint(const char *procName)
@@ -218,7 +219,7 @@ void glvndFreeEntrypoints(void)
     entrypointCount = 0;
 
     if (entrypointBufferExec != NULL) {
-        FreeExecPages(STUB_ENTRY_SIZE * GENERATED_ENTRYPOINT_MAX,
+        FreeExecPages(entrypointBufferSize,
                 entrypointBufferWrite, entrypointBufferExec);
         entrypointBufferWrite = NULL;
         entrypointBufferExec = NULL;
@@ -229,12 +230,13 @@ int InitEntrypoints(void)
 {
     if (entrypointBufferExec == NULL) {
         void *writeBuf, *execBuf;
-        if (AllocExecPages(STUB_ENTRY_SIZE * GENERATED_ENTRYPOINT_MAX,
-                &writeBuf, &execBuf) != 0) {
+        size_t size = RoundUpToHugePages(STUB_ENTRY_SIZE * GENERATED_ENTRYPOINT_MAX);
+        if (AllocExecPages(size, &writeBuf, &execBuf) != 0) {
             return -1;
         }
         entrypointBufferWrite = (uint8_t *) writeBuf;
         entrypointBufferExec = (uint8_t *) execBuf;
+        entrypointBufferSize = size;
     }
     return 0;
 }
@@ -66,6 +66,12 @@ static int OpenTempFile(const char *tempdir);
 static int AllocExecPagesFile(int fd, size_t size, void **writePtr, void **execPtr);
 static int AllocExecPagesAnonymous(size_t size, void **writePtr, void **execPtr);
 
+/**
+ * Calls mmap(2), but if \p size is a multiple of the huge page size, then
+ * aligns the mapping and asks for it to be backed by huge pages.
+ */
+static void *MapPages(size_t size, int prot, int flags, int fd);
+
 int glvnd_asprintf(char **strp, const char *fmt, ...)
 {
     va_list args;
@@ -202,13 +208,13 @@ int AllocExecPagesFile(int fd, size_t size, void **writePtr, void **execPtr)
         return -1;
     }
 
-    *execPtr = mmap(NULL, size, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    *execPtr = MapPages(size, PROT_READ | PROT_EXEC, MAP_SHARED, fd);
     if (*execPtr == MAP_FAILED) {
         *execPtr = NULL;
         return -1;
     }
 
-    *writePtr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    *writePtr = MapPages(size, PROT_READ | PROT_WRITE, MAP_SHARED, fd);
     if (*writePtr == MAP_FAILED) {
         munmap(*execPtr, size);
         *execPtr = *writePtr = NULL;
@@ -220,8 +226,8 @@ int AllocExecPagesFile(int fd, size_t size, void **writePtr, void **execPtr)
 
 int AllocExecPagesAnonymous(size_t size, void **writePtr, void **execPtr)
 {
-    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE | PROT_EXEC,
-            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    void *ptr = MapPages(size, PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1);
     if (ptr == MAP_FAILED) {
         return -1;
     }
@@ -230,6 +236,82 @@ int AllocExecPagesAnonymous(size_t size, void **writePtr, void **execPtr)
     return 0;
 }
 
+size_t GetHugePageSize(void)
+{
+    static int inited = 0;
+    static size_t hugePageSize = 0;
+
+    if (!inited) {
+#if defined(MADV_HUGEPAGE)
+        const char *str = getenv("__GLVND_HUGE_PAGES");
+        if (str != NULL && atoi(str) != 0) {
+            FILE *fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+            if (fp != NULL) {
+                unsigned long size;
+                if (fscanf(fp, "%lu", &size) == 1
+                        && size > (unsigned long) sysconf(_SC_PAGESIZE)
+                        && (size & (size - 1)) == 0) {
+                    hugePageSize = size;
+                }
+                fclose(fp);
+            }
+        }
+#endif // defined(MADV_HUGEPAGE)
+        inited = 1;
+    }
+    return hugePageSize;
+}
+
+size_t RoundUpToHugePages(size_t size)
+{
+    size_t hugePageSize = GetHugePageSize();
+    if (hugePageSize != 0) {
+        size = (size + hugePageSize - 1) & ~(hugePageSize - 1);
+    }
+    return size;
+}
+
+void *AllocHugePages(size_t size)
+{
+    void *ptr = MapPages(size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1);
+    return (ptr != MAP_FAILED ? ptr : NULL);
+}
+
+void *MapPages(size_t size, int prot, int flags, int fd)
+{
+#if defined(MADV_HUGEPAGE)
+    size_t hugePageSize = GetHugePageSize();
+
+    if (hugePageSize != 0 && size % hugePageSize == 0) {
+        // Reserve enough address space to find an aligned range, and then
+        // trim off the rest and map over it.
+        char *base = mmap(NULL, size + hugePageSize, PROT_NONE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base != MAP_FAILED) {
+            char *start = (char *) (((uintptr_t) base + hugePageSize - 1)
+                    & ~((uintptr_t) hugePageSize - 1));
+            void *ptr;
+
+            if (start > base) {
+                munmap(base, start - base);
+            }
+            munmap(start + size, (base + hugePageSize) - start);
+
+            ptr = mmap(start, size, prot, flags | MAP_FIXED, fd, 0);
+            if (ptr != MAP_FAILED) {
+                // If this fails, then we just get normal pages.
+                madvise(ptr, size, MADV_HUGEPAGE);
+                return ptr;
+            }
+            munmap(start, size);
+        }
+    }
+#endif // defined(MADV_HUGEPAGE)
+
+    return mmap(NULL, size, prot, flags, fd, 0);
+}
+
 void GetTempDirs(const char **dirs)
 {
     int count = 0;
@@ -90,6 +90,35 @@ int AllocExecPages(size_t size, void **writePtr, void **execPtr);
  */
 void FreeExecPages(size_t size, void *writePtr, void *execPtr);
 
+/**
+ * Returns the size of a transparent huge page, or zero if we shouldn't use
+ * huge pages.
+ *
+ * Huge pages are only used if the __GLVND_HUGE_PAGES environment variable is
+ * set, and if the kernel supports them.
+ */
+size_t GetHugePageSize(void);
+
+/**
+ * Rounds \p size up to a multiple of \c GetHugePageSize, or returns it
+ * unchanged if huge pages are disabled.
+ *
+ * \c AllocExecPages and \c AllocHugePages only try to use huge pages for a
+ * size that's a multiple of the huge page size.
+ */
+size_t RoundUpToHugePages(size_t size);
+
+/**
+ * Allocates zeroed read/write memory, backed by huge pages if possible. If
+ * the kernel can't provide huge pages, then it falls back to normal pages.
+ *
+ * The memory can be freed with munmap(2).
+ *
+ * \param size The number of bytes to allocate.
+ * \return A pointer to the memory, or NULL on error.
+ */
+void *AllocHugePages(size_t size);
+
 /*!
  * Swaps the bytes of an array.
  *
@@ -748,6 +748,15 @@ static void *dummyGetProcAddress(const char *procName)
     return NULL;
 }
 
+static void dummyGetProcAddressList(const char * const *procNames,
+        int count, void **procs)
+{
+    int i;
+    for (i=0; i<count; i++) {
+        procs[i] = dummyGetProcAddress(procNames[i]);
+    }
+}
+
 static void *dummyFindDispatchFunction(const char *name)
 {
     int i;
@@ -804,6 +813,7 @@ __egl_Main(uint32_t version, const __EGLapiExports *exports,
     imports->getProcAddress = dummyGetProcAddress;
     imports->getDispatchAddress = dummyFindDispatchFunction;
     imports->setDispatchIndex = dummySetDispatchIndex;
+    imports->getProcAddressList = dummyGetProcAddressList;
 
     return EGL_TRUE;
 }
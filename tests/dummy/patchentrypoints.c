@@ -43,11 +43,11 @@ static void patch_x86_64(char *writeEntry, const char *execEntry,
     // here uses a 64-bit address. Cast incrementPtr to a 64-bit integer so
     // that it's the right size for either build.
     uint64_t incrementAddr = (uint64_t) ((uintptr_t) incrementPtr);
+    // This is small enough to fit in the 16-byte x86-64 stubs.
     const char tmpl[] = {
-        0xa1, 0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, // movabs 0x123456789abcdef0, %eax
-        0x83, 0xc0, 0x01,                                     // add    $0x1,%eax
-        0xa3, 0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, // movabs %eax,0x123456789abcdef0
-        0xc3,                                                 // ret
+        0x48, 0xb8, 0xf0, 0xde, 0xbc, 0x9a, 0x78, 0x56, 0x34, 0x12, // movabs $0x123456789abcdef0, %rax
+        0xff, 0x00,                                                 // incl (%rax)
+        0xc3,                                                       // ret
     };
 
     if (stubSize < sizeof(tmpl)) {
@@ -55,8 +55,7 @@ static void patch_x86_64(char *writeEntry, const char *execEntry,
     }
 
     memcpy(writeEntry, tmpl, sizeof(tmpl));
-    memcpy(writeEntry + 1, &incrementAddr, sizeof(incrementAddr));
-    memcpy(writeEntry + 13, &incrementAddr, sizeof(incrementAddr));
+    memcpy(writeEntry + 2, &incrementAddr, sizeof(incrementAddr));
 
 #else
     assert(0); // Should not be calling this
@@ -0,0 +1,145 @@
+/*
+ * Copyright (c) 2017, NVIDIA CORPORATION.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and/or associated documentation files (the
+ * "Materials"), to deal in the Materials without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Materials, and to
+ * permit persons to whom the Materials are furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * unaltered in all copies or substantial portions of the Materials.
+ * Any additions, deletions, or changes to the original source files
+ * must be clearly indicated in accompanying documentation.
+ *
+ * If only executable code is distributed, then the accompanying
+ * documentation must state that "this software is based in part on the
+ * work of the Khronos Group."
+ *
+ * THE MATERIALS ARE PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ * IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+ * CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * MATERIALS OR THE USE OR OTHER DEALINGS IN THE MATERIALS.
+ */
+
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GL/gl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "dummy/EGL_dummy.h"
+#include "egl_test_utils.h"
+
+/**
+ * Checks that glGetString(GL_VENDOR) goes to the right vendor, or to a no-op
+ * function if \p vendorName is NULL.
+ */
+static int checkVendor(const char *vendorName)
+{
+    const char *str = (const char *) glGetString(GL_VENDOR);
+
+    if (vendorName == NULL) {
+        if (str != NULL) {
+            printf("glGetString returned \"%s\", expected NULL\n", str);
+            return 0;
+        }
+    } else if (str == NULL || strcmp(str, vendorName) != 0) {
+        printf("glGetString returned \"%s\", expected \"%s\"\n",
+                str ? str : "(null)", vendorName);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Runs in the child process. Nothing should be current after the fork, and
+ * the child should be able to make a context current again.
+ */
+static int runChild(EGLDisplay dpy, EGLContext ctx)
+{
+    if (eglGetCurrentContext() != EGL_NO_CONTEXT) {
+        printf("Context is still current in the child process\n");
+        return 1;
+    }
+    if (!checkVendor(NULL)) {
+        return 1;
+    }
+
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        printf("eglMakeCurrent failed in the child process\n");
+        return 1;
+    }
+    if (eglGetCurrentContext() != ctx || !checkVendor(DUMMY_VENDOR_NAMES[0])) {
+        return 1;
+    }
+
+    eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    EGLDisplay dpy;
+    EGLContext ctx;
+    pid_t pid;
+    int status;
+
+    loadEGLExtensions();
+
+    dpy = eglGetPlatformDisplay(EGL_DUMMY_PLATFORM,
+            (void *) DUMMY_VENDOR_NAMES[0], NULL);
+    if (dpy == EGL_NO_DISPLAY) {
+        printf("eglGetPlatformDisplay failed\n");
+        return 1;
+    }
+
+    ctx = eglCreateContext(dpy, NULL, EGL_NO_CONTEXT, NULL);
+    if (ctx == EGL_NO_CONTEXT) {
+        printf("eglCreateContext failed\n");
+        return 1;
+    }
+
+    if (!eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, ctx)) {
+        printf("eglMakeCurrent failed\n");
+        return 1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        return 1;
+    } else if (pid == 0) {
+        int result = runChild(dpy, ctx);
+        fflush(stdout);
+        _exit(result);
+    }
+
+    if (waitpid(pid, &status, 0) != pid) {
+        printf("waitpid failed\n");
+        return 1;
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Child process failed\n");
+        return 1;
+    }
+
+    // The parent process shouldn't notice the fork at all.
+    if (eglGetCurrentContext() != ctx || !checkVendor(DUMMY_VENDOR_NAMES[0])) {
+        return 1;
+    }
+
+    eglMakeCurrent(dpy, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(dpy, ctx);
+    return 0;
+}
@@ -0,0 +1,5 @@
+#!/bin/bash
+
+source $TOP_SRCDIR/tests/eglenv.sh
+
+./testeglfork
@@ -31,16 +31,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <getopt.h>
+#include <sched.h>
+#include <unistd.h>
 #include <GL/gl.h>
 
+#if HAVE_DECL_MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+#endif
+
 #include <GLdispatch.h>
 
 #include "dummy/patchentrypoints.h"
+#include "glvnd_pthread.h"
 
 #define DUMMY_VENDOR_COUNT 3
 #define NUM_GLDISPATCH_CALLS 2
 static const char *GENERATED_FUNCTION_NAME = "glDummyTestGLVND";
 
+/*
+ * The prefix and number of functions for TestManyDynamicStubs. This is more
+ * than the 4096 dynamic stubs that libGLdispatch used to support.
+ */
+static const char *MANY_FUNCTION_PREFIX = "glDummyManyTestGLVND";
+#define MANY_FUNCTION_COUNT 5000
+
+/*
+ * The number of calls that the other thread in TestLivePatch makes after the
+ * entrypoints are patched.
+ */
+#define LIVE_PATCH_CALLS 10000
+
 enum {
     CALL_INDEX_STATIC,
     CALL_INDEX_GENERATED,
@@ -55,6 +76,7 @@ typedef struct DummyVendorLibRec {
     pfn_glVertex3fv vertexProc;
     pfn_glVertex3fv testProc;
     __GLgetProcAddressCallback getProcCallback;
+    __GLgetProcAddressListCallback getProcListCallback;
 
     __GLdispatchThreadState threadState;
     __GLdispatchTable *dispatch;
@@ -70,6 +92,17 @@ static void CleanupDummyVendors(void);
 
 static GLboolean TestDispatch(int vendorIndex,
         GLboolean testStatic, GLboolean testGenerated);
+static GLboolean TestDerivedDispatch(void);
+static GLboolean TestCallCounts(void);
+static GLboolean TestManyDynamicStubs(void);
+static GLboolean TestLivePatch(GLboolean optIn);
+static GLboolean TestDirectDispatch(void);
+static GLboolean KernelSupportsLivePatch(void);
+static GLboolean TestStats(void);
+
+static void *layer_getProcAddressCallback(const char *procName, int slot, void *param);
+static void layer_glVertex3fv(const GLfloat *v);
+static void layer_glDummyTestProc(const GLfloat *v);
 
 static void *common_getProcAddressCallback(const char *procName, void *param, int vendorIndex);
 static GLboolean common_InitiatePatch(int type, int stubSize,
@@ -88,13 +121,16 @@ static GLboolean dummy1_InitiatePatch(int type, int stubSize,
         DispatchPatchLookupStubOffset lookupStubOffset);
 
 static void *dummy2_getProcAddressCallback(const char *procName, void *param);
+static GLboolean dummy2_getProcAddressListCallback(const char * const *procNames,
+        int count, void **procs, void *param);
 static void dummy2_glVertex3fv(const GLfloat *v);
 static void dummy2_glDummyTestProc(const GLfloat *v);
 
 static DummyVendorLib dummyVendors[DUMMY_VENDOR_COUNT] = {
     { dummy0_glVertex3fv, dummy0_glDummyTestProc, dummy0_getProcAddressCallback },
     { dummy1_glVertex3fv, dummy1_glDummyTestProc, dummy1_getProcAddressCallback },
-    { dummy2_glVertex3fv, dummy2_glDummyTestProc, dummy2_getProcAddressCallback },
+    { dummy2_glVertex3fv, dummy2_glDummyTestProc, dummy2_getProcAddressCallback,
+        dummy2_getProcAddressListCallback },
 };
 
 static pfn_glVertex3fv ptr_glVertex3fv;
@@ -103,13 +139,28 @@ static pfn_glVertex3fv ptr_glDummyTestProc;
 static GLboolean enableStaticTest = GL_FALSE;
 static GLboolean enableGeneratedTest = GL_FALSE;
 static GLboolean enablePatching = GL_FALSE;
+static GLboolean lateGeneratedLookup = GL_FALSE;
+static GLboolean enableDerivedTest = GL_FALSE;
+static GLboolean enableLayer = GL_FALSE;
+static GLboolean enableCallCountTest = GL_FALSE;
+static GLboolean expectCacheHits = GL_FALSE;
+static GLboolean enableManyStubsTest = GL_FALSE;
+static GLboolean partialPatching = GL_FALSE;
+static GLboolean enableLivePatchTest = GL_FALSE;
+static GLboolean enableDirectTest = GL_FALSE;
+static GLboolean expectLivePatch = GL_FALSE;
+
+static __GLdispatchLayer *testLayer;
+static int layerVertexSlot = -1;
+static int layerTestProcSlot = -1;
+static int layerCallCount;
 
 int main(int argc, char **argv)
 {
     int i;
 
     while (1) {
-        int opt = getopt(argc, argv, "sgp");
+        int opt = getopt(argc, argv, "sgpPldycCmtDL");
         if (opt == -1) {
             break;
         }
@@ -123,24 +174,86 @@ int main(int argc, char **argv)
         case 'p':
             enablePatching = GL_TRUE;
             break;
+        case 'P':
+            // Vendor 1 only patches the static function, so switching from
+            // vendor 0 has to restore the generated stub.
+            partialPatching = GL_TRUE;
+            break;
+        case 'l':
+            lateGeneratedLookup = GL_TRUE;
+            break;
+        case 'd':
+            enableDerivedTest = GL_TRUE;
+            break;
+        case 'y':
+            enableLayer = GL_TRUE;
+            break;
+        case 'c':
+            enableCallCountTest = GL_TRUE;
+            break;
+        case 'C':
+            expectCacheHits = GL_TRUE;
+            break;
+        case 'm':
+            enableManyStubsTest = GL_TRUE;
+            break;
+        case 't':
+            enableLivePatchTest = GL_TRUE;
+            break;
+        case 'D':
+            // This has to run before any other dispatch table is current.
+            enableDirectTest = GL_TRUE;
+            break;
+        case 'L':
+            // The build supports live patching, so -t and -D have to
+            // actually patch the entrypoints.
+            expectLivePatch = GL_TRUE;
+            break;
         default:
             return 1;
         }
     };
 
+    if (expectLivePatch && !KernelSupportsLivePatch()) {
+        // For automake tests, returning 77 indicates that this test was
+        // skipped.
+        printf("The kernel doesn't support live patching\n");
+        return 77;
+    }
+
     __glDispatchInit();
     InitDummyVendors();
 
+    if (enableLayer) {
+        testLayer = __glDispatchRegisterLayer(layer_getProcAddressCallback, NULL);
+        if (testLayer == NULL) {
+            printf("__glDispatchRegisterLayer failed\n");
+            return 1;
+        }
+    }
+
     ptr_glVertex3fv = (pfn_glVertex3fv) __glDispatchGetProcAddress("glVertex3fv");
     if (ptr_glVertex3fv == NULL) {
         printf("Can't find dispatch function for glVertex3fv\n");
     }
 
-    if (enableGeneratedTest) {
+    if (enableGeneratedTest && !lateGeneratedLookup) {
         ptr_glDummyTestProc = (pfn_glVertex3fv) __glDispatchGetProcAddress(GENERATED_FUNCTION_NAME);
         if (ptr_glDummyTestProc == NULL) {
             printf("Can't find dispatch function for %s\n", GENERATED_FUNCTION_NAME);
         }
+
+        // Looking up the same name again should find the same dynamic stub.
+        if ((pfn_glVertex3fv) __glDispatchGetProcAddress(GENERATED_FUNCTION_NAME) != ptr_glDummyTestProc) {
+            printf("Got a different dispatch function for %s\n", GENERATED_FUNCTION_NAME);
+            return 1;
+        }
+    }
+
+    if (enableDirectTest) {
+        if (!TestDirectDispatch()) {
+            return 1;
+        }
     }
 
     for (i=0; i<DUMMY_VENDOR_COUNT; i++) {
@@ -149,6 +262,47 @@ int main(int argc, char **argv)
         }
     }
 
+    if (enableCallCountTest) {
+        if (!TestCallCounts()) {
+            return 1;
+        }
+    }
+
+    if (enableDerivedTest) {
+        if (!TestDerivedDispatch()) {
+            return 1;
+        }
+    }
+
+    if (enableManyStubsTest) {
+        if (!TestManyDynamicStubs()) {
+            return 1;
+        }
+    }
+
+    if (enableLivePatchTest) {
+        // Vendor 0 has to opt in to live patching first.
+        if (!TestLivePatch(GL_FALSE) || !TestLivePatch(GL_TRUE)) {
+            return 1;
+        }
+    }
+
+    if (testLayer != NULL) {
+        // Make sure that the layer goes away after unregistering it.
+        if (!__glDispatchUnregisterLayer(testLayer)) {
+            printf("__glDispatchUnregisterLayer failed\n");
+            return 1;
+        }
+        testLayer = NULL;
+        if (!TestDispatch(0, enableStaticTest, enableGeneratedTest)) {
+            return 1;
+        }
+    }
+
+    if (!TestStats()) {
+        return 1;
+    }
+
     CleanupDummyVendors();
     __glDispatchFini();
     return 0;
@@ -164,8 +318,9 @@ static void InitDummyVendors(void)
             abort();
         }
 
-        dummyVendors[i].dispatch = __glDispatchCreateTable(
-                dummyVendors[i].getProcCallback, &dummyVendors[i]);
+        dummyVendors[i].dispatch = __glDispatchCreateTableWithList(
+                dummyVendors[i].getProcCallback,
+                dummyVendors[i].getProcListCallback, &dummyVendors[i]);
         if (dummyVendors[i].dispatch == NULL) {
             printf("__glDispatchCreateTable failed\n");
             abort();
@@ -202,6 +357,7 @@ static void ResetCallCounts(void)
             dummyVendors[i].callCounts[j] = 0;
         }
     }
+    layerCallCount = 0;
 }
 
 static GLboolean CheckCallCounts(int expectedVendorIndex, int expectedCallIndex, int count)
@@ -226,6 +382,12 @@ static GLboolean CheckCallCounts(int expectedVendorIndex, int expectedCallIndex,
             }
         }
     }
+
+    if (layerCallCount != (testLayer != NULL ? count : 0)) {
+        printf("Wrong value for layer: Expected %d, got %d\n",
+                (testLayer != NULL ? count : 0), layerCallCount);
+        result = GL_FALSE;
+    }
     return result;
 }
 
@@ -234,7 +396,10 @@ static GLboolean TestDispatch(int vendorIndex,
 {
     int i;
     GLboolean result = GL_FALSE;
-    GLboolean patched = (dummyVendors[vendorIndex].patchCallbacksPtr != NULL);
+    // Entrypoint patching is disabled while a layer is registered, and call
+    // counting uses a layer, too.
+    GLboolean patched = (dummyVendors[vendorIndex].patchCallbacksPtr != NULL
+            && testLayer == NULL && __glDispatchGetCallCounts(NULL, NULL, 0) == 0);
 
     if (!__glDispatchMakeCurrent(&dummyVendors[vendorIndex].threadState,
                 dummyVendors[vendorIndex].dispatch, dummyVendors[vendorIndex].vendorID,
@@ -267,7 +432,19 @@ static GLboolean TestDispatch(int vendorIndex,
     }
 
     if (testGenerated) {
-        int callIndex = (patched ? CALL_INDEX_GENERATED_PATCH : CALL_INDEX_GENERATED);
+        GLboolean patchedGenerated = (patched
+                && !(partialPatching && vendorIndex == 1));
+        int callIndex = (patchedGenerated ? CALL_INDEX_GENERATED_PATCH : CALL_INDEX_GENERATED);
+
+        if (ptr_glDummyTestProc == NULL) {
+            // Generate the stub while the vendor's dispatch table is already
+            // current.
+            ptr_glDummyTestProc = (pfn_glVertex3fv) __glDispatchGetProcAddress(GENERATED_FUNCTION_NAME);
+            if (ptr_glDummyTestProc == NULL) {
+                printf("Can't find dispatch function for %s\n", GENERATED_FUNCTION_NAME);
+                goto done;
+            }
+        }
 
         printf("Testing generated dispatch\n");
         ResetCallCounts();
@@ -286,6 +463,519 @@ done:
     return result;
 }
 
+typedef struct LivePatchThreadRec {
+    __GLdispatchThreadState threadState;
+    volatile int ready;
+    volatile int stop;
+    volatile int calls;
+    GLboolean failed;
+} LivePatchThread;
+
+static void *LivePatchThreadProc(void *param)
+{
+    LivePatchThread *t = (LivePatchThread *) param;
+
+    // Make vendor 0 current without any patch callbacks, so that the
+    // entrypoints are still unpatched when the main thread makes current.
+    if (!__glDispatchMakeCurrent(&t->threadState, dummyVendors[0].dispatch,
+                dummyVendors[0].vendorID, NULL)) {
+        t->failed = GL_TRUE;
+        t->ready = 1;
+        return NULL;
+    }
+    t->ready = 1;
+
+    while (!t->stop) {
+        glVertex3fv(NULL);
+        t->calls++;
+    }
+
+    __glDispatchLoseCurrent();
+    return NULL;
+}
+
+static GLboolean dummyLivePatchSupported(void)
+{
+    return GL_TRUE;
+}
+
+/**
+ * Makes vendor 0 current on the main thread while another thread is
+ * current and calling glVertex3fv, which should patch the entrypoints without
+ * waiting for the other thread.
+ *
+ * \param optIn If false, then vendor 0 doesn't allow live patching, so the
+ * entrypoints should be left alone.
+ */
+static GLboolean TestLivePatch(GLboolean optIn)
+{
+    LivePatchThread t;
+    glvnd_thread_t thread;
+    __GLdispatchStats stats;
+    GLuint64 liveBefore;
+    GLboolean patched;
+    GLboolean result = GL_FALSE;
+    int calls, i;
+
+    printf("Testing patching while another thread is current, optIn = %d\n",
+            (int) optIn);
+
+    glvndSetupPthreads();
+    if (__glvndPthreadFuncs.is_singlethreaded) {
+        printf("Threads aren't available\n");
+        return GL_FALSE;
+    }
+
+    dummyVendors[0].patchCallbacks.isLivePatchSupported =
+        (optIn ? dummyLivePatchSupported : NULL);
+
+    memset(&t, 0, sizeof(t));
+    ResetCallCounts();
+    __glDispatchGetStats(&stats);
+    liveBefore = stats.patchLiveSuccesses;
+
+    if (__glvndPthreadFuncs.create(&thread, NULL, LivePatchThreadProc, &t) != 0) {
+        printf("Can't create thread\n");
+        return GL_FALSE;
+    }
+    while (!t.ready) {
+        sched_yield();
+    }
+    if (t.failed) {
+        printf("__glDispatchMakeCurrent failed on the other thread\n");
+        __glvndPthreadFuncs.join(thread, NULL);
+        return GL_FALSE;
+    }
+
+    if (!__glDispatchMakeCurrent(&dummyVendors[0].threadState,
+                dummyVendors[0].dispatch, dummyVendors[0].vendorID,
+                dummyVendors[0].patchCallbacksPtr)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        t.stop = 1;
+        __glvndPthreadFuncs.join(thread, NULL);
+        return GL_FALSE;
+    }
+
+    __glDispatchGetStats(&stats);
+    patched = (stats.patchLiveSuccesses > liveBefore);
+    printf("patched = %d\n", (int) patched);
+
+    // Let the other thread keep running for a while after patching.
+    calls = t.calls;
+    while (t.calls < calls + LIVE_PATCH_CALLS) {
+        sched_yield();
+    }
+    t.stop = 1;
+    __glvndPthreadFuncs.join(thread, NULL);
+
+    if (!optIn && patched) {
+        printf("The entrypoints were patched without the vendor opting in\n");
+        goto done;
+    }
+    if (optIn && expectLivePatch && !patched) {
+        printf("The entrypoints weren't patched\n");
+        goto done;
+    }
+
+    // Every call from the other thread should go to vendor 0, whether or not
+    // it went through the patched entrypoint.
+    if (dummyVendors[0].callCounts[CALL_INDEX_STATIC]
+            + dummyVendors[0].callCounts[CALL_INDEX_STATIC_PATCH] != t.calls) {
+        printf("Wrong call counts from the other thread: %d + %d, expected %d\n",
+                dummyVendors[0].callCounts[CALL_INDEX_STATIC],
+                dummyVendors[0].callCounts[CALL_INDEX_STATIC_PATCH], t.calls);
+        goto done;
+    }
+    if (patched && dummyVendors[0].callCounts[CALL_INDEX_STATIC_PATCH] == 0) {
+        printf("The other thread never called the patched entrypoint\n");
+        goto done;
+    }
+
+    ResetCallCounts();
+    for (i = 0; i < NUM_GLDISPATCH_CALLS; i++) {
+        glVertex3fv(NULL);
+    }
+    if (!CheckCallCounts(0, (patched ? CALL_INDEX_STATIC_PATCH : CALL_INDEX_STATIC),
+                NUM_GLDISPATCH_CALLS)) {
+        goto done;
+    }
+
+    result = GL_TRUE;
+
+done:
+    __glDispatchLoseCurrent();
+    return result;
+}
+
+/**
+ * Returns true if the kernel has the membarrier command that libGLdispatch
+ * needs to patch the entrypoints while other threads are running them.
+ */
+static GLboolean KernelSupportsLivePatch(void)
+{
+#if HAVE_DECL_MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE
+    int cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    return (cmds >= 0 && (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED_SYNC_CORE));
+#else
+    return GL_FALSE;
+#endif
+}
+
+/**
+ * Calls glVertex3fv and the generated function, and checks that both went to
+ * \p vendorIndex, or nowhere if \p vendorIndex is -1.
+ */
+static GLboolean CallAndCheckDirect(int vendorIndex)
+{
+    int i;
+
+    ResetCallCounts();
+    for (i = 0; i < NUM_GLDISPATCH_CALLS; i++) {
+        glVertex3fv(NULL);
+    }
+    if (!CheckCallCounts(vendorIndex, CALL_INDEX_STATIC,
+                (vendorIndex >= 0 ? NUM_GLDISPATCH_CALLS : 0))) {
+        return GL_FALSE;
+    }
+
+    if (ptr_glDummyTestProc != NULL) {
+        ResetCallCounts();
+        for (i = 0; i < NUM_GLDISPATCH_CALLS; i++) {
+            ptr_glDummyTestProc(NULL);
+        }
+        if (!CheckCallCounts(vendorIndex, CALL_INDEX_GENERATED,
+                    (vendorIndex >= 0 ? NUM_GLDISPATCH_CALLS : 0))) {
+            return GL_FALSE;
+        }
+    }
+    return GL_TRUE;
+}
+
+/**
+ * Makes vendor 2 current, which should redirect the entrypoints straight to
+ * its functions, since it's the first and only table to be current. Losing
+ * the last current context has to restore the entrypoints, and making a
+ * different table current has to keep them restored.
+ */
+static GLboolean TestDirectDispatch(void)
+{
+    __GLdispatchStats stats;
+    GLuint64 directCount;
+    GLboolean direct;
+    const char *disallowPatchStr = getenv("__GLVND_DISALLOW_PATCHING");
+
+    printf("Testing direct dispatch\n");
+
+    if (!__glDispatchMakeCurrent(&dummyVendors[2].threadState,
+                dummyVendors[2].dispatch, dummyVendors[2].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        return GL_FALSE;
+    }
+
+    __glDispatchGetStats(&stats);
+    directCount = stats.directDispatchCount;
+    direct = (directCount > 0);
+    printf("direct = %d\n", (int) direct);
+
+    if (disallowPatchStr != NULL && atoi(disallowPatchStr) != 0 && direct) {
+        printf("The entrypoints were redirected with patching disabled\n");
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+    if (expectLivePatch && !direct) {
+        printf("The entrypoints weren't redirected\n");
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+
+    if (!CallAndCheckDirect(2)) {
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+    __glDispatchLoseCurrent();
+
+    // Without a current context, calls have to go to the no-op table.
+    if (!CallAndCheckDirect(-1)) {
+        return GL_FALSE;
+    }
+
+    // Making the same table current again should redirect the entrypoints
+    // again.
+    if (!__glDispatchMakeCurrent(&dummyVendors[2].threadState,
+                dummyVendors[2].dispatch, dummyVendors[2].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        return GL_FALSE;
+    }
+    __glDispatchGetStats(&stats);
+    if (stats.directDispatchCount != directCount + (direct ? 1 : 0)) {
+        printf("Wrong number of redirects: %llu, expected %llu\n",
+                (unsigned long long) stats.directDispatchCount,
+                (unsigned long long) (directCount + (direct ? 1 : 0)));
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+    directCount = stats.directDispatchCount;
+    if (!CallAndCheckDirect(2)) {
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+    __glDispatchLoseCurrent();
+
+    // Making a different table current has to restore the entrypoints.
+    if (!__glDispatchMakeCurrent(&dummyVendors[0].threadState,
+                dummyVendors[0].dispatch, dummyVendors[0].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        return GL_FALSE;
+    }
+    if (!CallAndCheckDirect(0)) {
+        __glDispatchLoseCurrent();
+        return GL_FALSE;
+    }
+    __glDispatchLoseCurrent();
+
+    if (!CallAndCheckDirect(-1)) {
+        return GL_FALSE;
+    }
+
+    __glDispatchGetStats(&stats);
+    if (stats.directDispatchCount != directCount) {
+        printf("The entrypoints were redirected again\n");
+        return GL_FALSE;
+    }
+    return GL_TRUE;
+}
+
+/**
+ * Generates more dynamic stubs than would fit in the first chunk of
+ * executable memory, while vendor 0's table is current, and then calls the
+ * first and last one.
+ */
+static GLboolean TestManyDynamicStubs(void)
+{
+    pfn_glVertex3fv procs[MANY_FUNCTION_COUNT];
+    char name[64];
+    int i;
+
+    printf("Testing %d dynamic stubs\n", MANY_FUNCTION_COUNT);
+
+    // Call the first stub without a current context, which should go to the
+    // no-op table.
+    snprintf(name, sizeof(name), "%s%d", MANY_FUNCTION_PREFIX, 0);
+    procs[0] = (pfn_glVertex3fv) __glDispatchGetProcAddress(name);
+    if (procs[0] == NULL) {
+        printf("Can't find dispatch function for %s\n", name);
+        return GL_FALSE;
+    }
+    procs[0](NULL);
+
+    if (!__glDispatchMakeCurrent(&dummyVendors[0].threadState,
+                dummyVendors[0].dispatch, dummyVendors[0].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        return GL_FALSE;
+    }
+
+    for (i=1; i<MANY_FUNCTION_COUNT; i++) {
+        snprintf(name, sizeof(name), "%s%d", MANY_FUNCTION_PREFIX, i);
+        procs[i] = (pfn_glVertex3fv) __glDispatchGetProcAddress(name);
+        if (procs[i] == NULL || procs[i] == procs[i - 1]) {
+            printf("Can't find dispatch function for %s\n", name);
+            __glDispatchLoseCurrent();
+            return GL_FALSE;
+        }
+    }
+
+    ResetCallCounts();
+    procs[0](NULL);
+    procs[MANY_FUNCTION_COUNT - 1](NULL);
+    __glDispatchLoseCurrent();
+
+    // The test layer doesn't wrap these functions, so just check the vendor's
+    // call count instead of using CheckCallCounts.
+    if (dummyVendors[0].callCounts[CALL_INDEX_GENERATED] != 2) {
+        printf("Wrong call count: Expected 2, got %d\n",
+                dummyVendors[0].callCounts[CALL_INDEX_GENERATED]);
+        return GL_FALSE;
+    }
+    return GL_TRUE;
+}
+
+/**
+ * Does a sanity check on the counters from __glDispatchGetStats.
+ */
+static GLboolean TestStats(void)
+{
+    __GLdispatchStats stats;
+    GLboolean result = GL_TRUE;
+
+    printf("Testing statistics\n");
+    __glDispatchGetStats(&stats);
+
+    if (stats.makeCurrentCount < DUMMY_VENDOR_COUNT
+            || stats.loseCurrentCount < DUMMY_VENDOR_COUNT) {
+        printf("Wrong MakeCurrent/LoseCurrent counts: %llu, %llu\n",
+                (unsigned long long) stats.makeCurrentCount,
+                (unsigned long long) stats.loseCurrentCount);
+        result = GL_FALSE;
+    }
+    if (stats.fixupCount < stats.makeCurrentCount) {
+        printf("Wrong fixup count: %llu\n", (unsigned long long) stats.fixupCount);
+        result = GL_FALSE;
+    }
+    if (stats.slotsResolved == 0) {
+        printf("No slots resolved\n");
+        result = GL_FALSE;
+    }
+    if (enableGeneratedTest && stats.stubsGenerated == 0) {
+        printf("No stubs generated\n");
+        result = GL_FALSE;
+    }
+    if (stats.lockCount == 0 || stats.lockContendedCount > stats.lockCount) {
+        printf("Wrong lock counts: %llu, %llu\n",
+                (unsigned long long) stats.lockCount,
+                (unsigned long long) stats.lockContendedCount);
+        result = GL_FALSE;
+    }
+    if (expectCacheHits && stats.slotsFromCache == 0) {
+        printf("No slots filled in from the dispatch cache\n");
+        result = GL_FALSE;
+    }
+    if (stats.patchSuccesses > stats.patchAttempts) {
+        printf("More patch successes than attempts\n");
+        result = GL_FALSE;
+    }
+    if (enablePatching && testLayer == NULL && !enableLayer
+            && __glDispatchGetCallCounts(NULL, NULL, 0) == 0
+            && stats.patchSuccesses == 0) {
+        printf("No successful patches\n");
+        result = GL_FALSE;
+    }
+
+    return result;
+}
+
+/**
+ * Checks the totals from __glDispatchGetCallCounts after running
+ * TestDispatch for every vendor.
+ */
+static GLboolean TestCallCounts(void)
+{
+    const char **names;
+    GLuint64 *counts;
+    GLuint64 expectedVertex = (enableStaticTest ? DUMMY_VENDOR_COUNT * NUM_GLDISPATCH_CALLS * 2 : 0);
+    GLuint64 expectedTestProc = (enableGeneratedTest ? DUMMY_VENDOR_COUNT * NUM_GLDISPATCH_CALLS : 0);
+    GLboolean result = GL_TRUE;
+    int count, i;
+
+    printf("Testing call counts\n");
+    count = __glDispatchGetCallCounts(NULL, NULL, 0);
+    if (count <= 0) {
+        printf("Call counting isn't supported\n");
+        return GL_TRUE;
+    }
+
+    names = malloc(count * sizeof(const char *));
+    counts = malloc(count * sizeof(GLuint64));
+    if (names == NULL || counts == NULL) {
+        abort();
+    }
+    count = __glDispatchGetCallCounts(names, counts, count);
+
+    for (i=0; i<count; i++) {
+        GLuint64 expected = 0;
+        if (strcmp(names[i], "glVertex3fv") == 0) {
+            expected = expectedVertex;
+        } else if (strcmp(names[i], GENERATED_FUNCTION_NAME) == 0) {
+            expected = expectedTestProc;
+        }
+        if (counts[i] != expected) {
+            printf("Wrong call count for %s: Expected %llu, got %llu\n",
+                    names[i], (unsigned long long) expected,
+                    (unsigned long long) counts[i]);
+            result = GL_FALSE;
+        }
+    }
+
+    free(names);
+    free(counts);
+    return result;
+}
+
+/**
+ * Tests a dispatch table derived from vendor 0's table. The derived table
+ * replaces glVertex3fv with vendor 1's function, and
+ * \c GENERATED_FUNCTION_NAME with a no-op.
+ */
+static GLboolean TestDerivedDispatch(void)
+{
+    __GLdispatchThreadState threadState;
+    __GLdispatchTable *derived;
+    GLboolean result = GL_FALSE;
+    int i;
+
+    derived = __glDispatchCreateDerivedTable(dummyVendors[0].dispatch);
+    if (derived == NULL) {
+        printf("__glDispatchCreateDerivedTable failed\n");
+        return GL_FALSE;
+    }
+
+    printf("Testing derived table without overrides\n");
+    if (!__glDispatchMakeCurrent(&threadState, derived,
+                dummyVendors[0].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        goto done;
+    }
+    ResetCallCounts();
+    for (i = 0; i < NUM_GLDISPATCH_CALLS; i++) {
+        glVertex3fv(NULL);
+    }
+    __glDispatchLoseCurrent();
+    if (!CheckCallCounts(0, CALL_INDEX_STATIC, NUM_GLDISPATCH_CALLS)) {
+        goto done;
+    }
+
+    if (__glDispatchSetTableOverride(dummyVendors[0].dispatch, "glVertex3fv",
+                (__GLdispatchProc) dummy1_glVertex3fv)) {
+        printf("__glDispatchSetTableOverride succeeded on a non-derived table\n");
+        goto done;
+    }
+    if (!__glDispatchSetTableOverride(derived, "glVertex3fv",
+                (__GLdispatchProc) dummy1_glVertex3fv)
+            || !__glDispatchSetTableOverride(derived, GENERATED_FUNCTION_NAME, NULL)) {
+        printf("__glDispatchSetTableOverride failed\n");
+        goto done;
+    }
+    if (ptr_glDummyTestProc == NULL) {
+        ptr_glDummyTestProc = (pfn_glVertex3fv) __glDispatchGetProcAddress(GENERATED_FUNCTION_NAME);
+    }
+
+    printf("Testing derived table with overrides\n");
+    if (!__glDispatchMakeCurrent(&threadState, derived,
+                dummyVendors[0].vendorID, NULL)) {
+        printf("__glDispatchMakeCurrent failed\n");
+        goto done;
+    }
+    ResetCallCounts();
+    for (i = 0; i < NUM_GLDISPATCH_CALLS; i++) {
+        glVertex3fv(NULL);
+        ptr_glDummyTestProc(NULL);
+    }
+    __glDispatchLoseCurrent();
+    if (!CheckCallCounts(1, CALL_INDEX_STATIC, NUM_GLDISPATCH_CALLS)) {
+        goto done;
+    }
+
+    printf("Testing parent table after overrides\n");
+    if (!TestDispatch(0, GL_TRUE, GL_TRUE)) {
+        goto done;
+    }
+
+    result = GL_TRUE;
+
+done:
+    __glDispatchDestroyTable(derived);
+    return result;
+}
+
 static void *common_getProcAddressCallback(const char *procName, void *param, int vendorIndex)
 {
     DummyVendorLib *dummyVendor = (DummyVendorLib *) param;
@@ -298,6 +988,8 @@ static void *common_getProcAddressCallback(const char *procName, void *param, in
         return dummyVendor->vertexProc;
     } else if (strcmp(procName, GENERATED_FUNCTION_NAME) == 0) {
         return dummyVendor->testProc;
+    } else if (strncmp(procName, MANY_FUNCTION_PREFIX, strlen(MANY_FUNCTION_PREFIX)) == 0) {
+        return dummyVendor->testProc;
     } else {
         return NULL;
     }
@@ -315,7 +1007,20 @@ static void *dummy1_getProcAddressCallback(const char *procName, void *param)
 
 static void *dummy2_getProcAddressCallback(const char *procName, void *param)
 {
-    return common_getProcAddressCallback(procName, param, 2);
+    // Vendor 2 provides a getProcAddressList callback, so libGLdispatch
+    // should never need to look up a single function.
+    printf("getProcAddress for vendor 2 called for %s\n", procName);
+    abort();
+}
+
+static GLboolean dummy2_getProcAddressListCallback(const char * const *procNames,
+        int count, void **procs, void *param)
+{
+    int i;
+    for (i=0; i<count; i++) {
+        procs[i] = common_getProcAddressCallback(procNames[i], param, 2);
+    }
+    return GL_TRUE;
 }
 
 static void dummy0_glVertex3fv(const GLfloat *v)
@@ -348,6 +1053,35 @@ static void dummy2_glDummyTestProc(const GLfloat *v)
     dummyVendors[2].callCounts[CALL_INDEX_GENERATED]++;
 }
 
+static void *layer_getProcAddressCallback(const char *procName, int slot, void *param)
+{
+    if (strcmp(procName, "glVertex3fv") == 0) {
+        layerVertexSlot = slot;
+        return layer_glVertex3fv;
+    } else if (strcmp(procName, GENERATED_FUNCTION_NAME) == 0) {
+        layerTestProcSlot = slot;
+        return layer_glDummyTestProc;
+    } else {
+        return NULL;
+    }
+}
+
+static void layer_glVertex3fv(const GLfloat *v)
+{
+    const __GLdispatchProc *next = __glDispatchGetLayerNextTable(testLayer);
+    layerCallCount++;
+    ((pfn_glVertex3fv) next[layerVertexSlot])(v);
+}
+
+static void layer_glDummyTestProc(const GLfloat *v)
+{
+    // This is a dynamic slot, which might not be in the flat part of the
+    // table.
+    __GLdispatchProc next = __glDispatchGetLayerNextProc(testLayer, layerTestProcSlot);
+    layerCallCount++;
+    ((pfn_glVertex3fv) next)(v);
+}
+
 static GLboolean common_InitiatePatch(int type, int stubSize,
         DispatchPatchLookupStubOffset lookupStubOffset, int vendorIndex)
 {
@@ -356,7 +1090,7 @@ static GLboolean common_InitiatePatch(int type, int stubSize,
         return GL_FALSE;
     }
 
-    if (enableGeneratedTest) {
+    if (enableGeneratedTest && !(partialPatching && vendorIndex == 1)) {
         if (!dummyPatchFunction(type, stubSize, lookupStubOffset, GENERATED_FUNCTION_NAME,
                     &dummyVendors[vendorIndex].callCounts[CALL_INDEX_GENERATED_PATCH])) {
             return GL_FALSE;
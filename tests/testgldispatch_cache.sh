@@ -0,0 +1,23 @@
+#!/bin/bash
+
+# Run the test twice with the dispatch cache enabled. The first run writes the
+# cache files, and the second one should use them. The cache needs an absolute
+# path for the library that contains the vendor functions, which in this case
+# is the test program itself.
+export __GLVND_DISPATCH_CACHE_DIR=$(mktemp -d)
+trap 'rm -rf "$__GLVND_DISPATCH_CACHE_DIR"' EXIT
+
+"$PWD/testgldispatch" -s -g || exit 1
+"$PWD/testgldispatch" -s -g -C || exit 1
+
+# Point every function in the cache files outside of the library. The cache
+# should be thrown out, rather than handing back garbage function pointers.
+for file in "$__GLVND_DISPATCH_CACHE_DIR"/*.cache ; do
+    count=$(od -An -tu4 -j12 -N4 "$file" | tr -d ' ')
+    pathLength=$(od -An -tu4 -j44 -N4 "$file" | tr -d ' ')
+    for ((i = 0; i < count; i++)) ; do
+        printf '\x40\x40\x40\x40\x40\x40\x40\x40' | dd of="$file" bs=1 \
+            seek=$((64 + pathLength + i * 16)) conv=notrunc status=none
+    done
+done
+"$PWD/testgldispatch" -s -g
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+__GLVND_COUNT_CALLS=1 ./testgldispatch -s -g -c
@@ -0,0 +1,13 @@
+#!/bin/bash
+
+# Redirecting the entrypoints uses the same code as live patching, so it has
+# to work whenever that does.
+if [ -n "$GLDISPATCH_PATCH_LIVE" ] ; then
+    __GLVND_DIRECT_DISPATCH=1 ./testgldispatch -s -g -D -L
+else
+    __GLVND_DIRECT_DISPATCH=1 ./testgldispatch -s -g -D
+fi
+[ $? -eq 0 ] || exit 1
+
+# __GLVND_DISALLOW_PATCHING has to keep the entrypoints from being redirected.
+__GLVND_DIRECT_DISPATCH=1 __GLVND_DISALLOW_PATCHING=1 ./testgldispatch -s -g -D
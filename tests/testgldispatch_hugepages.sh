@@ -0,0 +1,3 @@
+#!/bin/bash
+
+__GLVND_HUGE_PAGES=1 ./testgldispatch -s -g -y -m
@@ -0,0 +1,3 @@
+#!/bin/bash
+
+./testgldispatch -s -g -l -y
@@ -0,0 +1,4 @@
+#!/bin/bash
+
+__GLVND_LAZY_DISPATCH=1 ./testgldispatch -s -g
+
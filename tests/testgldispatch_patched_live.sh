@@ -0,0 +1,9 @@
+#!/bin/bash
+
+# If this build can patch the entrypoints while another thread is current,
+# then make sure that it really does.
+if [ -n "$GLDISPATCH_PATCH_LIVE" ] ; then
+    ./testgldispatch -s -g -p -t -L
+else
+    ./testgldispatch -s -g -p -t
+fi